@@ -81,7 +81,7 @@ namespace HBL2
         std::vector<T>::iterator begin() { return m_Packed.begin(); }
         std::vector<T>::iterator end() { return m_Packed.end(); }
 
-    private:
+        // Entity owning the component at position idx of the packed array.
         Entity GetEntity(uint32_t idx)
         {
             return m_Indices[idx];
@@ -19,22 +19,26 @@ namespace HBL2
 			}
 		}
 
-		void ForEach(std::function<void(Components&...)>&& func)
+		// Takes any invocable by type, optionally taking the Entity first, so the call inlines into the loop.
+		template<typename Func>
+		void ForEach(Func&& func)
 		{
-			ForEachImpl(func, std::index_sequence_for<Components...>{});
-		}
-
-		void ForEach(std::function<void(Entity, Components&...)>&& func)
-		{
-			ForEachWithEntityImpl(func, std::index_sequence_for<Components...>{});
+			if constexpr (std::is_invocable_v<Func&, Entity, Components&...>)
+			{
+				ForEachWithEntityImpl(func, std::index_sequence_for<Components...>{});
+			}
+			else
+			{
+				ForEachImpl(func, std::index_sequence_for<Components...>{});
+			}
 		}
 
 		ComponentMask::Iterator begin() const { return m_JointMask.begin(); }
 		ComponentMask::Iterator end() const { return m_JointMask.end(); }
 
 	private:
-		template<size_t... Indices>
-		void ForEachImpl(std::function<void(Components&...)>& func, std::index_sequence<Indices...>)
+		template<typename Func, size_t... Indices>
+		void ForEachImpl(Func& func, std::index_sequence<Indices...>)
 		{
 			for (Entity e : m_JointMask)
 			{
@@ -43,8 +47,8 @@ namespace HBL2
 		}
 
 		// Helper method to expand the parameter pack with entity
-		template<size_t... Indices>
-		void ForEachWithEntityImpl(std::function<void(Entity, Components&...)>& func, std::index_sequence<Indices...>)
+		template<typename Func, size_t... Indices>
+		void ForEachWithEntityImpl(Func& func, std::index_sequence<Indices...>)
 		{
 			for (Entity e : m_JointMask)
 			{
@@ -85,24 +89,25 @@ namespace HBL2
 
 		}
 
-		void ForEach(std::function<void(Component&)>&& func)
+		template<typename Func>
+		void ForEach(Func&& func)
 		{
 			ComponentArray<std::remove_const_t<Component>>& array = *(ComponentArray<std::remove_const_t<Component>>*)(m_Array);
 
-			for (Component& c : array)
+			if constexpr (std::is_invocable_v<Func&, Entity, Component&>)
 			{
-				func(c);
+				uint32_t index = 0;
+				for (Component& c : array)
+				{
+					func(array.GetEntity(index++), c);
+				}
 			}
-		}
-
-		void ForEach(std::function<void(Entity, Component&)>&& func)
-		{
-			ComponentArray<std::remove_const_t<Component>>& array = *(ComponentArray<std::remove_const_t<Component>>*)(m_Array);
-
-			uint32_t index = 0;
-			for (Component& c : array)
+			else
 			{
-				func(array.GetEntity(index++), c);
+				for (Component& c : array)
+				{
+					func(c);
+				}
 			}
 		}
 
@@ -5,7 +5,9 @@
 #include "Sceduler.h"
 #include "Query.h"
 
+#include <tuple>
 #include <typeinfo>
+#include <memory>
 
 namespace HBL2
 {
@@ -76,160 +78,146 @@ namespace HBL2
             return BasicQuery<Component>(EnsureArray<std::remove_const_t<Component>>());
         }
 
-        template<typename A>
-        void Run(std::function<void(A&)> func)
-        {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-
-            for (A& a : arrA)
-            {
-                func(a);
+        // Runs func over every entity that has all of Components. func is any invocable taking
+        // the components, optionally preceded by the Entity, and is called directly so it inlines.
+        template<typename... Components, typename Func> requires (sizeof...(Components) > 0)
+        void Run(Func&& func)
+        {
+            if constexpr (sizeof...(Components) == 1)
+            {
+                using A = std::tuple_element_t<0, std::tuple<Components...>>;
+                ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
+
+                if constexpr (std::is_invocable_v<Func&, Entity, A&>)
+                {
+                    uint32_t index = 0;
+                    for (A& a : arrA)
+                    {
+                        func(arrA.GetEntity(index++), a);
+                    }
+                }
+                else
+                {
+                    for (A& a : arrA)
+                    {
+                        func(a);
+                    }
+                }
             }
-        }
-
-        template<typename A>
-        void Schedule(std::function<void(A&)> func)
-        {
-            SystemEntry entry;
-            FillDeps<A>(entry);
-
-            entry.Task = [this, func]()
+            else
             {
-                this->Run<A>(func);
-            };
+                std::tuple<ComponentArray<std::remove_const_t<Components>>&...> arrays = { EnsureArray<std::remove_const_t<Components>>()... };
 
-            m_Sceduler.Register(entry);
-        }
+                // SIMD‐optimized AND
+                ComponentMask joint = std::get<0>(arrays).Mask();    // copy
+                std::apply([&](auto&, auto&... rest) { ((joint &= rest.Mask()), ...); }, arrays);
 
-        template<typename A>
-        void Run(std::function<void(Entity e, A&)> func)
-        {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-            uint32_t index = 0;
-            for (A& a : arrA)
-            {
-                func(arrA.GetEntity(index++), a);
+                RunJoint<Components...>(joint, arrays, func, std::index_sequence_for<Components...>{});
             }
         }
 
-        template<typename A>
-        void Schedule(std::function<void(Entity e, A&)> func)
+        // Registers func as a system run by ExecuteScheduledSystems, see Sceduler.
+        template<typename... Components, typename Func> requires (sizeof...(Components) > 0)
+        SystemID Schedule(Func&& func)
         {
             SystemEntry entry;
-            FillDeps<A>(entry);
+            (FillDeps<Components>(entry), ...);
 
-            entry.Task = [this, func]()
+            entry.Task = [this, func = std::forward<Func>(func)]() mutable
             {
-                this->Run<A>(func);
+                this->Run<Components...>(func);
             };
 
-            m_Sceduler.Register(entry);
+            return m_Sceduler.Register(entry);
         }
 
-        template<typename A, typename B>
-        void Run(std::function<void(A&, B&)> func)
+        // Like Schedule, but the system may be split over entity ranges that run in parallel, see Sceduler.
+        // func is called concurrently for distinct entities so it is invoked as const and must not
+        // touch shared state without synchronization.
+        template<typename... Components, typename Func> requires (sizeof...(Components) > 0)
+        SystemID ScheduleParallel(Func&& func)
         {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-            ComponentArray<std::remove_const_t<B>>& arrB = EnsureArray<std::remove_const_t<B>>();
+            SystemEntry entry;
+            (FillDeps<Components>(entry), ...);
+
+            // The parts must not create arrays concurrently
+            (EnsureArray<std::remove_const_t<Components>>(), ...);
 
-            // SIMD‐optimized AND
-            ComponentMask joint = arrA.Mask();    // copy
-            joint &= arrB.Mask();
+            // Joint mask of the frame, shared by the parts of the system
+            std::shared_ptr<ComponentMask> joint = std::make_shared<ComponentMask>();
 
-            for (Entity e : joint)
+            entry.Prepare = [this, joint]() -> const ComponentMask&
             {
-                func((A&)arrA.Get(e), (B&)arrB.Get(e));
-            }
-        }
+                if constexpr (sizeof...(Components) == 1)
+                {
+                    return EnsureArray<std::remove_const_t<Components>...>().Mask();
+                }
+                else
+                {
+                    std::tuple<ComponentArray<std::remove_const_t<Components>>&...> arrays = { EnsureArray<std::remove_const_t<Components>>()... };
 
-        template<typename A, typename B>
-        void Schedule(std::function<void(A&, B&)> func)
-        {
-            SystemEntry entry;
-            FillDeps<A>(entry);
-            FillDeps<B>(entry);
+                    *joint = std::get<0>(arrays).Mask();
+                    std::apply([&](auto&, auto&... rest) { ((*joint &= rest.Mask()), ...); }, arrays);
+                    return *joint;
+                }
+            };
 
-            entry.Task = [this, func]()
+            entry.RangeTask = [this, joint, func = std::forward<Func>(func)](uint32_t first, uint32_t last)
             {
-                this->Run<A, B>(func);
+                std::tuple<ComponentArray<std::remove_const_t<Components>>&...> arrays = { EnsureArray<std::remove_const_t<Components>>()... };
+
+                const ComponentMask& mask = sizeof...(Components) == 1 ? std::get<0>(arrays).Mask() : *joint;
+                RunJoint<Components...>(mask.range(first, last), arrays, func, std::index_sequence_for<Components...>{});
             };
 
-            m_Sceduler.Register(entry);
+            return m_Sceduler.Register(entry);
         }
 
-        template<typename A, typename B>
-        void Run(std::function<void(Entity e, A&, B&)> func)
+        // Makes 'first' finish before 'second' starts, in addition to their component access.
+        // Returns false and leaves the order unchanged if the dependency would close a cycle.
+        bool ScheduleBefore(SystemID first, SystemID second)
         {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-            ComponentArray<std::remove_const_t<B>>& arrB = EnsureArray<std::remove_const_t<B>>();
-
-            // SIMD‐optimized AND
-            ComponentMask joint = arrA.Mask();    // copy
-            joint &= arrB.Mask();
-
-            for (Entity e : joint)
-            {
-                func(e, arrA.Get(e), arrB.Get(e));
-            }
+            return m_Sceduler.AddDependency(first, second);
         }
 
-        template<typename A, typename B>
-        void Schedule(std::function<void(Entity e, A&, B&)> func)
+        // Removes a scheduled system, the scheduler recompiles its plan on the next run.
+        void RemoveSystem(SystemID system)
         {
-            SystemEntry entry;
-            FillDeps<A>(entry);
-            FillDeps<B>(entry);
-
-            entry.Task = [this, func]()
-            {
-                this->Run<A, B>(func);
-            };
-
-            m_Sceduler.Register(entry);
+            m_Sceduler.Remove(system);
         }
 
-        template<typename A, typename B, typename C>
-        void Run(std::function<void(A&, B&, C&)> func)
+        void SetSystemEnabled(SystemID system, bool enabled)
         {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-            ComponentArray<std::remove_const_t<B>>& arrB = EnsureArray<std::remove_const_t<B>>();
-            ComponentArray<std::remove_const_t<C>>& arrC = EnsureArray<std::remove_const_t<C>>();
-
-            // SIMD‐optimized AND
-            ComponentMask joint = arrA.Mask();    // copy
-            joint &= arrB.Mask();
-            joint &= arrC.Mask();
-
-            for (Entity e : joint)
-            {
-                func(arrA.Get(e), arrB.Get(e), arrC.Get(e));
-            }
+            m_Sceduler.SetEnabled(system, enabled);
         }
 
-        template<typename A, typename B, typename C>
-        void Run(std::function<void(Entity e, A&, B&, C&)> func)
+        void ExecuteScheduledSystems()
         {
-            ComponentArray<std::remove_const_t<A>>& arrA = EnsureArray<std::remove_const_t<A>>();
-            ComponentArray<std::remove_const_t<B>>& arrB = EnsureArray<std::remove_const_t<B>>();
-            ComponentArray<std::remove_const_t<C>>& arrC = EnsureArray<std::remove_const_t<C>>();
-
-            // SIMD‐optimized AND
-            ComponentMask joint = arrA.Mask();    // copy
-            joint &= arrB.Mask();
-            joint &= arrC.Mask();
-
-            for (Entity e : joint)
-            {
-                func(e, arrA.Get(e), arrB.Get(e), arrC.Get(e));
-            }
+            m_Sceduler.RunAll();
         }
 
-        void ExecuteScheduledSystems()
+        void ClearScheduledSystems()
         {
-            m_Sceduler.RunAll();
+            m_Sceduler.Clear();
         }
 
     private:
+        template<typename... Components, typename Entities, typename Arrays, typename Func, size_t... Indices>
+        void RunJoint(const Entities& entities, Arrays& arrays, Func& func, std::index_sequence<Indices...>)
+        {
+            for (Entity e : entities)
+            {
+                if constexpr (std::is_invocable_v<Func&, Entity, Components&...>)
+                {
+                    func(e, (Components&)std::get<Indices>(arrays).Get(e)...);
+                }
+                else
+                {
+                    func((Components&)std::get<Indices>(arrays).Get(e)...);
+                }
+            }
+        }
+
         template<typename T>
         ComponentArray<T>& EnsureArray()
         {
@@ -1,90 +1,470 @@
 ﻿#pragma once
 
 #include "ComponentArray.h"
-#include "Utilities\JobSystem.h"
+#include "../Utilities/JobSystem.h"
 
 #include <functional>
 #include <bitset>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <bit>
 
 namespace HBL2
 {
 	using ComponentMaskType = std::bitset<MAX_COMPONENT_TYPES>;
+	using SystemID = uint32_t;
+
+	// Systems matching fewer entities than this are never split into parts
+	constexpr size_t SYSTEM_SPLIT_MIN_ENTITIES = 8192;
 
 	struct SystemEntry
 	{
 		ComponentMaskType ReadMask;
 		ComponentMaskType WriteMask;
 		std::function<void()> Task;
+
+		// Optional data parallel form, used instead of Task when set. Prepare returns the mask of the
+		// entities the system will visit this frame, RangeTask runs it over mask blocks [first, last).
+		std::function<const ComponentMask&()> Prepare;
+		std::function<void(uint32_t, uint32_t)> RangeTask;
 	};
 
+	// Runs the registered systems as a dependency graph. Two systems depend on each other when their
+	// component access conflicts (write/write or read/write), in registration order unless explicit
+	// constraints say otherwise. Each system is released as soon as all of its predecessors finished,
+	// there is no barrier between unrelated systems.
+	//
+	// The graph is compiled once into a flat plan and reused every frame, it is only rebuilt after a
+	// system is added, removed, enabled or disabled. A frame costs one atomic decrement per edge.
+	//
+	// A data parallel system is split when it runs, into parts of about equal population by the mask
+	// blocks of its matching entities. The parts run next to the other systems of the graph and the
+	// last part to finish releases the successors.
 	class Sceduler
 	{
 	public:
-		void Register(SystemEntry& entry)
+		SystemID Register(SystemEntry& entry)
 		{
-			m_Entries.push_back(std::move(entry));
+			SystemID system;
+			if (!m_FreeSlots.empty())
+			{
+				system = m_FreeSlots.back();
+				m_FreeSlots.pop_back();
+			}
+			else
+			{
+				system = (SystemID)m_Systems.size();
+				m_Systems.emplace_back();
+			}
+
+			SystemSlot& slot = m_Systems[system];
+			slot.Entry = std::move(entry);
+			slot.Alive = true;
+			slot.Enabled = true;
+
+			// A reused slot is registered last, keep registration order for its conflicts
+			slot.Order = m_NextOrder++;
+
+			m_Dirty = true;
+			return system;
+		}
+
+		// Removes the system and every constraint it is part of, the id may be reused by a later Register.
+		void Remove(SystemID system)
+		{
+			HBL2_CORE_ASSERT(IsValid(system), "Invalid system!");
+
+			m_Systems[system] = SystemSlot{};
+			m_FreeSlots.push_back(system);
+
+			std::erase_if(m_Constraints, [system](const std::pair<SystemID, SystemID>& c) { return c.first == system || c.second == system; });
+
+			m_Dirty = true;
+		}
+
+		// A disabled system is left out of the plan, its explicit constraints still order the systems around it.
+		void SetEnabled(SystemID system, bool enabled)
+		{
+			HBL2_CORE_ASSERT(IsValid(system), "Invalid system!");
+
+			if (m_Systems[system].Enabled != enabled)
+			{
+				m_Systems[system].Enabled = enabled;
+				m_Dirty = true;
+			}
+		}
+
+		bool IsEnabled(SystemID system) const
+		{
+			return IsValid(system) && m_Systems[system].Enabled;
+		}
+
+		// Explicit ordering on top of the component access, 'first' finishes before 'second' starts.
+		// Returns false and adds nothing if 'second' is already ordered before 'first', as that would close a cycle.
+		bool AddDependency(SystemID first, SystemID second)
+		{
+			HBL2_CORE_ASSERT(IsValid(first) && IsValid(second) && first != second, "Invalid system dependency!");
+
+			if (Reaches(second, first))
+			{
+				return false;
+			}
+
+			m_Constraints.push_back({ first, second });
+			m_Dirty = true;
+			return true;
+		}
+
+		void Clear()
+		{
+			m_Systems.clear();
+			m_FreeSlots.clear();
+			m_Constraints.clear();
+			m_Plan = CompiledPlan{};
+			m_Pending.reset();
+			m_Parts.reset();
+			m_NextOrder = 0;
+			m_Dirty = false;
 		}
 
 		void RunAll()
 		{
-			std::vector<std::vector<SystemEntry>> batches;
+			if (m_Dirty)
+			{
+				Compile();
+			}
+
+			if (m_Plan.Roots.empty())
+			{
+				return;
+			}
+
+			JobContext ctx;
+			for (uint32_t node : m_Plan.Roots)
+			{
+				Launch(ctx, node);
+			}
+			JobSystem::Get().Wait(ctx);
+		}
+
+	private:
+		struct SystemSlot
+		{
+			SystemEntry Entry;
+			uint64_t Order = 0;
+			bool Alive = false;
+			bool Enabled = false;
+		};
 
-			ComponentMaskType batchReadMask;
-			ComponentMaskType batchWriteMask;
+		// Immutable between invalidations. Node i runs system Nodes[i], its successors are
+		// Successors[SuccessorOffsets[i] .. SuccessorOffsets[i + 1]).
+		struct CompiledPlan
+		{
+			std::vector<SystemID> Nodes;
+			std::vector<uint32_t> Predecessors;
+			std::vector<uint32_t> SuccessorOffsets;
+			std::vector<uint32_t> Successors;
+			std::vector<uint32_t> Roots;
+		};
 
-			batches.emplace_back();
-			std::vector<SystemEntry>* currentBatch = &batches.back();
+		bool IsValid(SystemID system) const
+		{
+			return system < m_Systems.size() && m_Systems[system].Alive;
+		}
 
-			for (const auto& sys : m_Entries)
+		// Whether the explicit constraints already order 'from' before 'to', directly or through other systems.
+		bool Reaches(SystemID from, SystemID to) const
+		{
+			std::vector<bool> visited(m_Systems.size(), false);
+			std::vector<SystemID> stack = { from };
+			visited[from] = true;
+
+			while (!stack.empty())
 			{
-				// Check conflicts with current batch.
-				bool conflict =
-					(sys.WriteMask & batchWriteMask).any() ||  // WW conflict
-					(sys.WriteMask & batchReadMask).any() ||   // WR conflict
-					(sys.ReadMask & batchWriteMask).any();     // RW conflict
+				SystemID system = stack.back();
+				stack.pop_back();
 
-				if (conflict)
+				if (system == to)
 				{
-					// Start new batch
-					batches.emplace_back();
-					batchReadMask.reset();
-					batchWriteMask.reset();
-					currentBatch = &batches.back();
+					return true;
 				}
 
-				// Add system to current batch.
-				currentBatch->push_back(sys);
+				for (const auto& [first, second] : m_Constraints)
+				{
+					if (first == system && !visited[second])
+					{
+						visited[second] = true;
+						stack.push_back(second);
+					}
+				}
+			}
+
+			return false;
+		}
 
-				// Update read and write mask for current batch.
-				batchReadMask |= sys.ReadMask;
-				batchWriteMask |= sys.WriteMask;
+		void Launch(JobContext& ctx, uint32_t node)
+		{
+			JobSystem::Get().Execute(ctx, [this, &ctx, node]()
+			{
+				SystemEntry& entry = m_Systems[m_Plan.Nodes[node]].Entry;
+
+				if (!entry.RangeTask)
+				{
+					entry.Task();
+					Release(ctx, node);
+					return;
+				}
+
+				RunParts(ctx, node, entry);
+			});
+		}
+
+		void RunParts(JobContext& ctx, uint32_t node, SystemEntry& entry)
+		{
+			const ComponentMask& mask = entry.Prepare();
+
+			size_t population = mask.count();
+			size_t parts = std::min<size_t>(JobSystem::Get().GetThreadCount(), population / SYSTEM_SPLIT_MIN_ENTITIES);
+
+			if (parts <= 1)
+			{
+				entry.RangeTask(0, (uint32_t)L0_BLOCKS);
+				Release(ctx, node);
+				return;
+			}
+
+			// Cut the active blocks into runs of about population / parts entities
+			uint32_t bounds[L0_BLOCKS + 1];
+			uint32_t boundCount = 0;
+			bounds[boundCount++] = 0;
+
+			size_t target = (population + parts - 1) / parts;
+			size_t accumulated = 0;
+			uint64_t blocks = mask.active_blocks();
+			while (blocks)
+			{
+				uint32_t b = (uint32_t)std::countr_zero(blocks);
+				blocks &= blocks - 1;
+
+				accumulated += mask.count_block(b);
+				if (accumulated >= target && blocks)
+				{
+					bounds[boundCount++] = b + 1;
+					accumulated = 0;
+				}
 			}
+			bounds[boundCount++] = (uint32_t)L0_BLOCKS;
 
-			// Execute batches
-			for (const auto& batch : batches)
+			const uint32_t partCount = boundCount - 1;
+			m_Parts[node].store(partCount, std::memory_order_relaxed);
+
+			auto runPart = [this, &ctx, node, &entry](uint32_t first, uint32_t last)
 			{
-				if (batch.size() == 1)
+				entry.RangeTask(first, last);
+				if (m_Parts[node].fetch_sub(1, std::memory_order_acq_rel) == 1)
 				{
-					batch[0].Task();
+					Release(ctx, node);
 				}
-				else
+			};
+
+			for (uint32_t part = 1; part < partCount; ++part)
+			{
+				JobSystem::Get().Execute(ctx, [runPart, first = bounds[part], last = bounds[part + 1]]()
 				{
-					JobContext ctx;
-					for (const auto& sys : batch)
+					runPart(first, last);
+				});
+			}
+
+			// The first part runs on this thread
+			runPart(bounds[0], bounds[1]);
+		}
+
+		void Release(JobContext& ctx, uint32_t node)
+		{
+			for (uint32_t i = m_Plan.SuccessorOffsets[node]; i < m_Plan.SuccessorOffsets[node + 1]; ++i)
+			{
+				uint32_t next = m_Plan.Successors[i];
+
+				// The last predecessor to finish re-arms the counter for the next frame and releases the node
+				if (m_Pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					m_Pending[next].store(m_Plan.Predecessors[next], std::memory_order_relaxed);
+					Launch(ctx, next);
+				}
+			}
+		}
+
+		void Compile()
+		{
+			m_Plan = CompiledPlan{};
+
+			// Plan nodes are the enabled systems in registration order
+			std::vector<uint32_t> nodeOf(m_Systems.size(), UINT32_MAX);
+			for (SystemID system = 0; system < m_Systems.size(); ++system)
+			{
+				if (m_Systems[system].Alive && m_Systems[system].Enabled)
+				{
+					m_Plan.Nodes.push_back(system);
+				}
+			}
+			std::sort(m_Plan.Nodes.begin(), m_Plan.Nodes.end(), [this](SystemID a, SystemID b) { return m_Systems[a].Order < m_Systems[b].Order; });
+
+			const uint32_t count = (uint32_t)m_Plan.Nodes.size();
+			for (uint32_t node = 0; node < count; ++node)
+			{
+				nodeOf[m_Plan.Nodes[node]] = node;
+			}
+
+			std::vector<std::vector<uint32_t>> successors(count);
+			m_Plan.Predecessors.assign(count, 0);
+
+			BuildGraph(nodeOf, successors);
+
+			m_Plan.SuccessorOffsets.reserve(count + 1);
+			m_Plan.SuccessorOffsets.push_back(0);
+			for (uint32_t node = 0; node < count; ++node)
+			{
+				m_Plan.Successors.insert(m_Plan.Successors.end(), successors[node].begin(), successors[node].end());
+				m_Plan.SuccessorOffsets.push_back((uint32_t)m_Plan.Successors.size());
+
+				if (m_Plan.Predecessors[node] == 0)
+				{
+					m_Plan.Roots.push_back(node);
+				}
+			}
+
+			m_Pending.reset(new std::atomic<uint32_t>[count]);
+			m_Parts.reset(new std::atomic<uint32_t>[count]);
+			for (uint32_t node = 0; node < count; ++node)
+			{
+				m_Pending[node].store(m_Plan.Predecessors[node], std::memory_order_relaxed);
+			}
+
+			m_Dirty = false;
+		}
+
+		void BuildGraph(const std::vector<uint32_t>& nodeOf, std::vector<std::vector<uint32_t>>& successors)
+		{
+			const uint32_t count = (uint32_t)m_Plan.Nodes.size();
+
+			// Constraints between enabled systems, bridged through disabled ones so the ordering around them is kept
+			std::vector<std::vector<SystemID>> after(m_Systems.size());
+			for (const auto& [first, second] : m_Constraints)
+			{
+				after[first].push_back(second);
+			}
+
+			std::vector<std::pair<uint32_t, uint32_t>> constraints;
+			for (uint32_t node = 0; node < count; ++node)
+			{
+				std::vector<SystemID> stack(after[m_Plan.Nodes[node]]);
+				std::vector<bool> visited(m_Systems.size(), false);
+				while (!stack.empty())
+				{
+					SystemID system = stack.back();
+					stack.pop_back();
+
+					if (visited[system])
 					{
-						JobSystem::Get().Execute(ctx, sys.Task);
+						continue;
+					}
+					visited[system] = true;
+
+					if (nodeOf[system] != UINT32_MAX)
+					{
+						constraints.push_back({ node, nodeOf[system] });
+					}
+					else
+					{
+						stack.insert(stack.end(), after[system].begin(), after[system].end());
+					}
+				}
+			}
+
+			// Order the nodes by the explicit constraints, ties broken by registration order
+			std::vector<std::vector<uint32_t>> constrained(count);
+			std::vector<uint32_t> constraintCount(count, 0);
+			for (const auto& [first, second] : constraints)
+			{
+				constrained[first].push_back(second);
+				constraintCount[second]++;
+			}
+
+			std::vector<uint32_t> rank(count);
+			std::vector<uint32_t> ready;
+			for (uint32_t node = count; node-- > 0;)
+			{
+				if (constraintCount[node] == 0)
+				{
+					ready.push_back(node);
+				}
+			}
+
+			uint32_t ordered = 0;
+			while (!ready.empty())
+			{
+				// Lowest registration index first, 'ready' is kept sorted descending
+				uint32_t node = ready.back();
+				ready.pop_back();
+				rank[node] = ordered++;
+
+				for (uint32_t next : constrained[node])
+				{
+					if (--constraintCount[next] == 0)
+					{
+						ready.insert(std::upper_bound(ready.begin(), ready.end(), next, std::greater<uint32_t>()), next);
+					}
+				}
+			}
+
+			HBL2_CORE_ASSERT(ordered == count, "System dependencies contain a cycle!");
+
+			// Edges for explicit constraints and for every conflicting pair, oriented by rank
+			for (const auto& [first, second] : constraints)
+			{
+				AddEdge(successors, first, second);
+			}
+
+			for (uint32_t a = 0; a < count; ++a)
+			{
+				for (uint32_t b = a + 1; b < count; ++b)
+				{
+					if (Conflict(m_Systems[m_Plan.Nodes[a]].Entry, m_Systems[m_Plan.Nodes[b]].Entry))
+					{
+						rank[a] < rank[b] ? AddEdge(successors, a, b) : AddEdge(successors, b, a);
 					}
-					JobSystem::Get().Wait(ctx);
 				}
 			}
 		}
 
+		void AddEdge(std::vector<std::vector<uint32_t>>& successors, uint32_t from, uint32_t to)
+		{
+			if (std::find(successors[from].begin(), successors[from].end(), to) == successors[from].end())
+			{
+				successors[from].push_back(to);
+				m_Plan.Predecessors[to]++;
+			}
+		}
+
+		static bool Conflict(const SystemEntry& a, const SystemEntry& b)
+		{
+			return
+				(a.WriteMask & b.WriteMask).any() ||   // WW conflict
+				(a.WriteMask & b.ReadMask).any() ||    // WR conflict
+				(a.ReadMask & b.WriteMask).any();      // RW conflict
+		}
 
 	private:
-		std::mutex mu;
-		std::condition_variable cv;
-		JobContext m_JobContext;
-		std::vector<SystemEntry> m_Entries;
+		std::vector<SystemSlot> m_Systems;
+		std::vector<SystemID> m_FreeSlots;
+		std::vector<std::pair<SystemID, SystemID>> m_Constraints;
+		uint64_t m_NextOrder = 0;
+
+		CompiledPlan m_Plan;
+		std::unique_ptr<std::atomic<uint32_t>[]> m_Pending;
+		std::unique_ptr<std::atomic<uint32_t>[]> m_Parts;
+		bool m_Dirty = false;
 	};
-}
\ No newline at end of file
+}
@@ -53,6 +53,37 @@ namespace HBL2
             return l0 != 0;
         }
 
+        // Number of set bits, only active groups are visited
+        size_t count() const
+        {
+            size_t total = 0;
+            uint64_t blocks = l0;
+            while (blocks)
+            {
+                total += count_block(bit_scan_forward(blocks));
+                blocks &= blocks - 1;
+            }
+            return total;
+        }
+
+        // Number of set bits in block b, a block covers L1_GROUPS * L2_BITS entities
+        size_t count_block(size_t b) const
+        {
+            size_t total = 0;
+            uint64_t groups = l1[b];
+            while (groups)
+            {
+                total += pop_count(l2[b][bit_scan_forward(groups)]);
+                groups &= groups - 1;
+            }
+            return total;
+        }
+
+        uint64_t active_blocks() const
+        {
+            return l0;
+        }
+
         void clear()
         {
             l0 = 0;
@@ -65,46 +96,84 @@ namespace HBL2
 
         void operator&=(const SparseFlatBitmap3L& other)
         {
+            // Blocks only active here become empty
+            uint64_t dropBlocks = l0 & ~other.l0;
+            while (dropBlocks)
+            {
+                size_t b = bit_scan_forward(dropBlocks);
+                clear_groups(b, l1[b]);
+                l1[b] = 0;
+                dropBlocks &= dropBlocks - 1;
+            }
+
             l0 &= other.l0;
 
-            for (size_t b = 0; b < L0_BLOCKS; ++b)
+            // Only touch blocks active in both operands
+            uint64_t blocks = l0;
+            while (blocks)
             {
-                l1[b] &= other.l1[b];
+                size_t b = bit_scan_forward(blocks);
+                blocks &= blocks - 1;
 
-                // Process 64 groups per block, each group is 64 bits (uint64_t)
-                // Use AVX2 to process 4 uint64_t (256 bits) at once
-                for (size_t g = 0; g < L1_GROUPS; g += 4)
+                uint64_t both = l1[b] & other.l1[b];
+                clear_groups(b, l1[b] & ~both);
+
+                uint64_t result = 0;
+                if (both == ~0ULL)
                 {
-                    // Load 4 uint64_t from this bitmap and other bitmap
-                    __m256i v1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(&l2[b][g]));
-                    __m256i v2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(&other.l2[b][g]));
+                    // Fully active block, use AVX2 to process 4 uint64_t (256 bits) at once
+                    for (size_t g = 0; g < L1_GROUPS; g += 4)
+                    {
+                        __m256i v1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(&l2[b][g]));
+                        __m256i v2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(&other.l2[b][g]));
+                        _mm256_store_si256(reinterpret_cast<__m256i*>(&l2[b][g]), _mm256_and_si256(v1, v2));
+                    }
 
-                    // Bitwise AND
-                    __m256i vand = _mm256_and_si256(v1, v2);
+                    for (size_t g = 0; g < L1_GROUPS; ++g)
+                    {
+                        result |= (uint64_t)(l2[b][g] != 0) << g;
+                    }
+                }
+                else
+                {
+                    while (both)
+                    {
+                        size_t g = bit_scan_forward(both);
+                        l2[b][g] &= other.l2[b][g];
+                        result |= (uint64_t)(l2[b][g] != 0) << g;
+                        both &= both - 1;
+                    }
+                }
 
-                    // Store result back
-                    _mm256_store_si256(reinterpret_cast<__m256i*>(&l2[b][g]), vand);
+                // Recompute the summaries from the result
+                l1[b] = result;
+                if (result == 0)
+                {
+                    l0 &= ~(1ULL << b);
                 }
             }
         }
 
-        // Iterator optimized with bit scanning
+        // Iterator optimized with bit scanning, empty groups and blocks are skipped through l1/l0
         struct Iterator
         {
             const SparseFlatBitmap3L& map;
             uint32_t current_entity = 0;
             size_t b = 0, g = 0;
             uint64_t bits = 0;
+            uint64_t block_limit = ~0ULL;
 
-            Iterator(const SparseFlatBitmap3L& m, bool end = false) : map(m), b(0), g(0)
+            Iterator(const SparseFlatBitmap3L& m, bool end = false, uint64_t blocks = ~0ULL) : map(m), b(0), g(0), block_limit(blocks)
             {
-                if (end)
+                if (end || (map.l0 & block_limit) == 0)
                 {
                     current_entity = max_entity;
                 }
                 else
                 {
-                    bits = map.l2[b][g]; // Initialize bits here!
+                    b = bit_scan_forward(map.l0 & block_limit);
+                    g = bit_scan_forward(map.l1[b]);
+                    bits = map.l2[b][g];
                     advance_to_next();
                 }
             }
@@ -127,34 +196,53 @@ namespace HBL2
         private:
             void advance_to_next()
             {
-                while (true)
+                while (bits == 0)
                 {
-                    if (bits != 0)
+                    // Next active group in this block
+                    uint64_t groups = (g + 1 < L1_GROUPS) ? (map.l1[b] & (~0ULL << (g + 1))) : 0;
+                    if (groups == 0)
                     {
-                        int bit_index = bit_scan_forward(bits);
-                        current_entity = static_cast<uint32_t>((b << 12) | (g << 6) | bit_index);
-                        return;
-                    }
-                    // Move to next group
-                    ++g;
-                    if (g >= L1_GROUPS)
-                    {
-                        g = 0;
-                        ++b;
-                        if (b >= L0_BLOCKS)
+                        // Next active block
+                        uint64_t blocks = (b + 1 < L0_BLOCKS) ? (map.l0 & block_limit & (~0ULL << (b + 1))) : 0;
+                        if (blocks == 0)
                         {
                             current_entity = max_entity;
                             return;
                         }
+
+                        b = bit_scan_forward(blocks);
+                        groups = map.l1[b];
                     }
+
+                    g = bit_scan_forward(groups);
                     bits = map.l2[b][g];
                 }
+
+                int bit_index = bit_scan_forward(bits);
+                current_entity = static_cast<uint32_t>((b << 12) | (g << 6) | bit_index);
             }
         };
 
         Iterator begin() const { return Iterator(*this); }
         Iterator end() const { return Iterator(*this, true); }
 
+        // The set bits of blocks [first, last) only, used to split an iteration into independent parts
+        struct Range
+        {
+            const SparseFlatBitmap3L& map;
+            uint64_t blocks;
+
+            Iterator begin() const { return Iterator(map, false, blocks); }
+            Iterator end() const { return Iterator(map, true); }
+        };
+
+        Range range(size_t first, size_t last) const
+        {
+            uint64_t upper = last >= L0_BLOCKS ? ~0ULL : ((1ULL << last) - 1);
+            uint64_t lower = first >= L0_BLOCKS ? 0 : (~0ULL << first);
+            return { *this, upper & lower };
+        }
+
     private:
         static constexpr uint32_t max_entity = L0_BLOCKS * L1_GROUPS * L2_BITS;
 
@@ -162,6 +250,15 @@ namespace HBL2
         alignas(64) std::array<uint64_t, L0_BLOCKS> l1{};
         alignas(64) uint64_t l0 = 0;
 
+        void clear_groups(size_t b, uint64_t groups)
+        {
+            while (groups)
+            {
+                l2[b][bit_scan_forward(groups)] = 0;
+                groups &= groups - 1;
+            }
+        }
+
         static constexpr std::tuple<uint32_t, uint32_t, uint32_t> split(uint32_t entity)
         {
             uint32_t i = entity & 0x3F;
@@ -179,6 +276,15 @@ namespace HBL2
             return static_cast<int>(index);
 #else
             return __builtin_ctzll(x);
+#endif
+        }
+
+        static inline int pop_count(uint64_t x)
+        {
+#if defined(_MSC_VER)
+            return static_cast<int>(__popcnt64(x));
+#else
+            return __builtin_popcountll(x);
 #endif
         }
     };
@@ -9,6 +9,7 @@
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <thread>
 
 namespace HBL2
 {
@@ -663,6 +664,169 @@ namespace HBL2
 
     }
 
+    void test_dag_scheduling()
+    {
+        JobSystem::Initialize();
+
+        {
+            Registry reg;
+
+            std::vector<Entity> ents(1000);
+            for (size_t i = 0; i < ents.size(); ++i)
+            {
+                ents[i] = reg.CreateEntity();
+                reg.AddComponent<Position>(ents[i], { 0, 0, 0 });
+                reg.AddComponent<Velocity>(ents[i], { 1, 0, 0 });
+                reg.AddComponent<AIState>(ents[i], { 0 });
+            }
+
+            // Writers of Velocity run before its readers, in registration order
+            reg.Schedule<Velocity>([](Velocity& v) { v.dx *= 2; });
+            reg.Schedule<Position, const Velocity>([](Position& p, const Velocity& v) { p.x += v.dx; });
+            reg.Schedule<AIState>([](AIState& ai) { ai.state++; });
+
+            reg.ExecuteScheduledSystems();
+            reg.ExecuteScheduledSystems();
+
+            size_t checked = 0;
+            reg.Run<const Position, const AIState>([&](const Position& p, const AIState& ai)
+            {
+                assert(p.x == 6 && ai.state == 2);
+                checked++;
+            });
+            assert(checked == ents.size());
+        }
+
+        {
+            Registry reg;
+            Entity e = reg.CreateEntity();
+            reg.AddComponent<Position>(e, { 0, 0, 0 });
+            reg.AddComponent<AIState>(e, { 0 });
+
+            // A system with no shared components does not wait for a slow one registered before it.
+            // The slow system holds on until the AIState system is done, bounded so a wrong plan fails the order check.
+            const bool parallel = JobSystem::Get().GetThreadCount() >= 2;
+            std::atomic<int> sequence = 0;
+            std::atomic<int> slowSeq = -1, readerSeq = -1, aiSeq = -1;
+            reg.Schedule<Position>([&](Position&)
+            {
+                for (uint32_t spins = 0; parallel && aiSeq < 0 && spins < 10000000; ++spins)
+                {
+                    std::this_thread::yield();
+                }
+                slowSeq = sequence++;
+            });
+            reg.Schedule<const Position>([&](const Position&) { readerSeq = sequence++; });
+            reg.Schedule<AIState>([&](AIState&) { aiSeq = sequence++; });
+
+            reg.ExecuteScheduledSystems();
+            assert(slowSeq >= 0 && slowSeq < readerSeq);
+            assert(aiSeq < slowSeq || !parallel);
+        }
+
+        {
+            Registry reg;
+            Entity e = reg.CreateEntity();
+            reg.AddComponent<Position>(e, { 0, 0, 0 });
+            reg.AddComponent<AIState>(e, { 0 });
+
+            std::mutex orderMutex;
+            std::vector<int> order;
+
+            // Explicit edges override registration order
+            SystemID writer = reg.Schedule<AIState>([&](AIState&)
+            {
+                std::lock_guard lock(orderMutex);
+                order.push_back(1);
+            });
+            SystemID reader = reg.Schedule<const Position>([&](const Position&)
+            {
+                std::lock_guard lock(orderMutex);
+                order.push_back(2);
+            });
+            bool added = reg.ScheduleBefore(reader, writer);
+
+            // The reverse edge would close a cycle, it is rejected and the order is kept
+            bool reversed = reg.ScheduleBefore(writer, reader);
+            assert(added && !reversed);
+
+            reg.ExecuteScheduledSystems();
+            assert(order.size() == 2 && order[0] == 2 && order[1] == 1);
+
+            // Disabled and removed systems are skipped, the plan is recompiled on the next run
+            std::atomic<int> runs = 0;
+            SystemID counter = reg.Schedule<const AIState>([&](const AIState&) { runs++; });
+
+            // Cycles through other systems are rejected as well
+            bool chained = reg.ScheduleBefore(writer, counter);
+            bool closing = reg.ScheduleBefore(counter, reader);
+            assert(chained && !closing);
+
+            reg.SetSystemEnabled(counter, false);
+            reg.ExecuteScheduledSystems();
+            assert(runs == 0);
+
+            reg.SetSystemEnabled(counter, true);
+            reg.ExecuteScheduledSystems();
+            assert(runs == 1);
+
+            order.clear();
+            reg.RemoveSystem(writer);
+            reg.ExecuteScheduledSystems();
+            assert(order.size() == 1 && order[0] == 2 && runs == 2);
+
+            reg.ClearScheduledSystems();
+            reg.ExecuteScheduledSystems();
+            assert(runs == 2);
+        }
+
+        {
+            Registry reg;
+
+            std::vector<Entity> ents(200000);
+            for (size_t i = 0; i < ents.size(); ++i)
+            {
+                ents[i] = reg.CreateEntity();
+                reg.AddComponent<AIState>(ents[i], { (int)i });
+
+                if (i % 3)
+                {
+                    reg.AddComponent<Velocity>(ents[i], { 0, 0, 0 });
+                }
+            }
+
+            // Large systems are split into entity ranges, every entity is still visited once per frame
+            std::atomic<int> visits = 0;
+            reg.ScheduleParallel<const AIState, Velocity>([&visits](const AIState& ai, Velocity& v)
+            {
+                v.dx += (float)ai.state;
+                visits++;
+            });
+
+            reg.ExecuteScheduledSystems();
+            reg.ExecuteScheduledSystems();
+
+            int moving = 0;
+            reg.Run<const AIState, const Velocity>([&](const AIState& ai, const Velocity& v)
+            {
+                assert(ai.state % 3 != 0 && v.dx == 2.0f * (float)ai.state);
+                moving++;
+            });
+            assert(moving == (int)(ents.size() - (ents.size() + 2) / 3));
+            assert(visits == 2 * moving);
+        }
+
+        JobSystem::Shutdown();
+
+        std::cout << "DAG scheduling tests passed\n";
+    }
+
+    // Entry point for the behavior tests, each test asserts on failure and prints a line when it passes.
+    void run_tests()
+    {
+        test_dag_scheduling();
+    }
+
     void test_meta()
     {
         struct NewComponent {
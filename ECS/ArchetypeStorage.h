@@ -0,0 +1,478 @@
+#pragma once
+
+#include "IComponentStorage.h"
+
+#include <bitset>
+#include <unordered_map>
+
+namespace HBL2
+{
+    static constexpr size_t ARCHETYPE_CHUNK_SIZE = 16 * 1024; // 16KB chunks, fits comfortably in L1/L2
+    static constexpr size_t ARCHETYPE_COLUMN_ALIGNMENT = 32; // Keep every column AVX aligned
+
+    using ArchetypeSignature = std::bitset<MAX_COMPONENT_TYPES>;
+
+    // Type erased operations needed to move a component between archetypes.
+    struct ArchetypeColumnType
+    {
+        size_t Size = 0;
+        size_t Alignment = 0;
+        void (*Construct)(void* dst) = nullptr;
+        void (*MoveConstruct)(void* dst, void* src) = nullptr;
+        void (*Destroy)(void* ptr) = nullptr;
+    };
+
+    // A unique set of component types. Entities are stored densely across fixed size chunks,
+    // each chunk laid out as SoA: [Entity x capacity][Column0 x capacity][Column1 x capacity]...
+    class Archetype
+    {
+    public:
+        Archetype(const ArchetypeSignature& signature, const ArchetypeColumnType* types)
+            : m_Signature(signature)
+        {
+            for (auto& column : m_ColumnIndex)
+            {
+                column = UINT16_MAX;
+            }
+
+            size_t rowBytes = sizeof(Entity);
+            for (size_t id = 0; id < MAX_COMPONENT_TYPES; ++id)
+            {
+                if (signature.test(id))
+                {
+                    m_ColumnIndex[id] = (uint16_t)m_Columns.size();
+                    m_Columns.push_back({ (uint8_t)id, 0, types[id] });
+                    rowBytes += types[id].Size;
+                }
+            }
+
+            // Shrink the capacity until every aligned column fits in one chunk.
+            m_Capacity = std::max((uint32_t)(ARCHETYPE_CHUNK_SIZE / rowBytes), 1u);
+            while (m_Capacity > 1 && Layout(m_Capacity) > ARCHETYPE_CHUNK_SIZE)
+            {
+                m_Capacity--;
+            }
+
+            // Rows larger than a chunk get chunks of a single, oversized row.
+            m_ChunkBytes = std::max(Layout(m_Capacity), ARCHETYPE_CHUNK_SIZE);
+        }
+
+        ~Archetype()
+        {
+            Clear();
+
+            for (uint8_t* chunk : m_Chunks)
+            {
+                ::operator delete(chunk, std::align_val_t(ARCHETYPE_COLUMN_ALIGNMENT));
+            }
+        }
+
+        const ArchetypeSignature& Signature() const { return m_Signature; }
+        uint32_t Size() const { return m_Size; }
+        uint32_t Capacity() const { return m_Capacity; }
+        uint32_t ChunkCount() const { return (m_Size + m_Capacity - 1) / m_Capacity; }
+
+        // Number of live rows in the given chunk, only the last used chunk can be partially filled.
+        uint32_t ChunkSize(uint32_t chunk) const
+        {
+            uint32_t begin = chunk * m_Capacity;
+            return (m_Size - begin < m_Capacity) ? (m_Size - begin) : m_Capacity;
+        }
+
+        bool HasColumn(uint8_t typeId) const { return m_ColumnIndex[typeId] != UINT16_MAX; }
+
+        Entity* Entities(uint32_t chunk) const
+        {
+            return (Entity*)m_Chunks[chunk];
+        }
+
+        void* Column(uint32_t chunk, uint8_t typeId) const
+        {
+            HBL2_CORE_ASSERT(HasColumn(typeId), "Archetype does not contain requested component.");
+            return m_Chunks[chunk] + m_Columns[m_ColumnIndex[typeId]].Offset;
+        }
+
+        void* At(uint32_t row, uint8_t typeId) const
+        {
+            const Col& col = m_Columns[m_ColumnIndex[typeId]];
+            return m_Chunks[row / m_Capacity] + col.Offset + (row % m_Capacity) * col.Type.Size;
+        }
+
+        // Appends an entity with uninitialized columns and returns its row.
+        uint32_t Push(Entity e)
+        {
+            uint32_t row = m_Size++;
+            if (row / m_Capacity >= m_Chunks.size())
+            {
+                m_Chunks.push_back((uint8_t*)::operator new(m_ChunkBytes, std::align_val_t(ARCHETYPE_COLUMN_ALIGNMENT)));
+            }
+
+            Entities(row / m_Capacity)[row % m_Capacity] = e;
+            return row;
+        }
+
+        // Swap-removes a row. If 'destroy' is false the columns of the row have already been moved out.
+        // Returns the entity that was moved into the row, or UINT32_MAX if the last row was removed.
+        Entity RemoveRow(uint32_t row, bool destroy)
+        {
+            uint32_t last = m_Size - 1;
+
+            for (const Col& col : m_Columns)
+            {
+                if (destroy)
+                {
+                    col.Type.Destroy(At(row, col.TypeID));
+                }
+
+                if (row != last)
+                {
+                    col.Type.MoveConstruct(At(row, col.TypeID), At(last, col.TypeID));
+                    col.Type.Destroy(At(last, col.TypeID));
+                }
+            }
+
+            Entity moved = UINT32_MAX;
+            if (row != last)
+            {
+                moved = Entities(last / m_Capacity)[last % m_Capacity];
+                Entities(row / m_Capacity)[row % m_Capacity] = moved;
+            }
+
+            m_Size--;
+            return moved;
+        }
+
+        void Clear()
+        {
+            for (uint32_t row = 0; row < m_Size; ++row)
+            {
+                for (const Col& col : m_Columns)
+                {
+                    col.Type.Destroy(At(row, col.TypeID));
+                }
+            }
+
+            m_Size = 0;
+        }
+
+        template<typename Func>
+        void ForEachColumn(Func&& func) const
+        {
+            for (const Col& col : m_Columns)
+            {
+                func(col.TypeID, col.Type);
+            }
+        }
+
+    private:
+        struct Col
+        {
+            uint8_t TypeID;
+            size_t Offset;
+            ArchetypeColumnType Type;
+        };
+
+        // Assigns column offsets for the given capacity and returns the total chunk bytes used.
+        size_t Layout(uint32_t capacity)
+        {
+            size_t offset = sizeof(Entity) * capacity;
+            for (Col& col : m_Columns)
+            {
+                size_t alignment = std::max(col.Type.Alignment, ARCHETYPE_COLUMN_ALIGNMENT);
+                offset = (offset + alignment - 1) & ~(alignment - 1);
+                col.Offset = offset;
+                offset += col.Type.Size * capacity;
+            }
+
+            return offset;
+        }
+
+    private:
+        ArchetypeSignature m_Signature;
+        std::vector<Col> m_Columns;
+        uint16_t m_ColumnIndex[MAX_COMPONENT_TYPES];
+        std::vector<uint8_t*> m_Chunks;
+        size_t m_ChunkBytes = ARCHETYPE_CHUNK_SIZE;
+        uint32_t m_Capacity = 0;
+        uint32_t m_Size = 0;
+    };
+
+    // Owns all archetypes of a registry and tracks where each archetype managed entity lives.
+    // Only component types whose storage is an ArchetypeComponentStorage take part in the signature,
+    // so archetype and sparse storages can be mixed freely on the same entity.
+    class ArchetypeStorage
+    {
+    public:
+        ArchetypeStorage() = default;
+        ArchetypeStorage(const ArchetypeStorage&) = delete;
+        ArchetypeStorage& operator=(const ArchetypeStorage&) = delete;
+
+        ~ArchetypeStorage()
+        {
+            for (Archetype* archetype : m_Archetypes)
+            {
+                delete archetype;
+            }
+        }
+
+        template<typename T>
+        void RegisterType(uint8_t typeId)
+        {
+            ArchetypeColumnType& type = m_Types[typeId];
+            type.Size = sizeof(T);
+            type.Alignment = alignof(T);
+            type.Construct = [](void* dst) { new(dst) T{}; };
+            type.MoveConstruct = [](void* dst, void* src) { new(dst) T(std::move(*(T*)src)); };
+            type.Destroy = [](void* ptr) { ((T*)ptr)->~T(); };
+        }
+
+        // Moves the entity into the archetype that also contains 'typeId' and returns the new (default constructed) component.
+        void* Add(Entity e, uint8_t typeId)
+        {
+            if (EntityIndex(e) >= m_Records.size())
+            {
+                m_Records.resize(EntityIndex(e) + 1);
+            }
+
+            Record record = m_Records[EntityIndex(e)];
+
+            ArchetypeSignature signature = record.Owner ? record.Owner->Signature() : ArchetypeSignature{};
+            HBL2_CORE_ASSERT(!signature.test(typeId), "Entity already has requested component.");
+            signature.set(typeId);
+
+            Archetype* dst = FindOrCreate(signature);
+            uint32_t row = dst->Push(e);
+
+            if (record.Owner)
+            {
+                Move(record, dst, row);
+            }
+
+            m_Types[typeId].Construct(dst->At(row, typeId));
+            m_Records[EntityIndex(e)] = { dst, row };
+
+            return dst->At(row, typeId);
+        }
+
+        // Moves the entity into the archetype without 'typeId', destroying that component.
+        void Remove(Entity e, uint8_t typeId)
+        {
+            Record record = m_Records[EntityIndex(e)];
+            HBL2_CORE_ASSERT(record.Owner && record.Owner->HasColumn(typeId), "Entity does not have requested component.");
+
+            ArchetypeSignature signature = record.Owner->Signature();
+            signature.reset(typeId);
+
+            if (signature.none())
+            {
+                Entity moved = record.Owner->RemoveRow(record.Row, true);
+                if (moved != UINT32_MAX)
+                {
+                    m_Records[EntityIndex(moved)].Row = record.Row;
+                }
+
+                m_Records[EntityIndex(e)] = {};
+                return;
+            }
+
+            Archetype* dst = FindOrCreate(signature);
+            uint32_t row = dst->Push(e);
+
+            m_Types[typeId].Destroy(record.Owner->At(record.Row, typeId));
+            Move(record, dst, row);
+
+            m_Records[EntityIndex(e)] = { dst, row };
+        }
+
+        void* Get(Entity e, uint8_t typeId) const
+        {
+            const Record& record = m_Records[EntityIndex(e)];
+            return record.Owner->At(record.Row, typeId);
+        }
+
+        // Invokes func(archetype, chunk, count) for every non empty chunk of every archetype that contains all of 'signature'.
+        template<typename Func>
+        void ForEachChunk(const ArchetypeSignature& signature, Func&& func) const
+        {
+            for (Archetype* archetype : m_Archetypes)
+            {
+                if ((archetype->Signature() & signature) != signature)
+                {
+                    continue;
+                }
+
+                for (uint32_t chunk = 0, n = archetype->ChunkCount(); chunk < n; ++chunk)
+                {
+                    func(*archetype, chunk, archetype->ChunkSize(chunk));
+                }
+            }
+        }
+
+    private:
+        struct Record
+        {
+            Archetype* Owner = nullptr;
+            uint32_t Row = 0;
+        };
+
+        Archetype* FindOrCreate(const ArchetypeSignature& signature)
+        {
+            auto it = m_Lookup.find(signature);
+            if (it != m_Lookup.end())
+            {
+                return it->second;
+            }
+
+            Archetype* archetype = new Archetype(signature, m_Types);
+            m_Archetypes.push_back(archetype);
+            m_Lookup.emplace(signature, archetype);
+            return archetype;
+        }
+
+        // Moves the shared columns of 'src' into row 'dstRow' of 'dst' and swap-removes the source row.
+        // Columns that do not exist in 'dst' must already be destroyed by the caller.
+        void Move(const Record& src, Archetype* dst, uint32_t dstRow)
+        {
+            src.Owner->ForEachColumn([&](uint8_t typeId, const ArchetypeColumnType& type)
+            {
+                if (dst->HasColumn(typeId))
+                {
+                    type.MoveConstruct(dst->At(dstRow, typeId), src.Owner->At(src.Row, typeId));
+                    type.Destroy(src.Owner->At(src.Row, typeId));
+                }
+            });
+
+            Entity moved = src.Owner->RemoveRow(src.Row, false);
+            if (moved != UINT32_MAX)
+            {
+                m_Records[EntityIndex(moved)].Row = src.Row;
+            }
+        }
+
+    private:
+        ArchetypeColumnType m_Types[MAX_COMPONENT_TYPES];
+        std::vector<Archetype*> m_Archetypes;
+        std::unordered_map<ArchetypeSignature, Archetype*> m_Lookup;
+        std::vector<Record> m_Records;
+    };
+
+    // IComponentStorage adapter for a component type managed by the registry's ArchetypeStorage.
+    // Select it per type with Registry::SetStorageType<T, ArchetypeComponentStorage<T>>().
+    template<typename T>
+    class ArchetypeComponentStorage final : IComponentStorage
+    {
+    public:
+        ArchetypeComponentStorage(ArchetypeStorage& archetypes)
+            : m_Archetypes(archetypes), m_TypeID(ComponentTypeID::Get<T>())
+        {
+            m_Archetypes.RegisterType<T>(m_TypeID);
+        }
+
+        virtual void* Add(Entity e) override
+        {
+            void* ptr = m_Archetypes.Add(e, m_TypeID);
+
+            if (EntityIndex(e) >= m_Positions.size())
+            {
+                m_Positions.resize(EntityIndex(e) + 1, UINT32_MAX);
+            }
+
+            m_Positions[EntityIndex(e)] = (uint32_t)m_Indices.size();
+            m_Indices.push_back(e);
+            m_Mask.set(e);
+
+            NotifyAdd(e);
+
+            return ptr;
+        }
+
+        virtual void Remove(Entity e) override
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+
+            m_Archetypes.Remove(e, m_TypeID);
+
+            uint32_t pos = m_Positions[EntityIndex(e)];
+            Entity lastEntity = m_Indices.back();
+            m_Indices[pos] = lastEntity;
+            m_Positions[EntityIndex(lastEntity)] = pos;
+            m_Indices.pop_back();
+            m_Positions[EntityIndex(e)] = UINT32_MAX;
+
+            m_Mask.reset(e);
+
+            NotifyRemove(e);
+        }
+
+        virtual void* Get(Entity e) override
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+            return m_Archetypes.Get(e, m_TypeID);
+        }
+
+        virtual bool Has(Entity e) override
+        {
+            return m_Mask.test(e);
+        }
+
+        virtual ComponentMaskAVX& Mask() const override { return const_cast<ComponentMaskAVX&>(m_Mask); }
+
+        virtual const Span<const Entity> Indices() const override
+        {
+            return m_Indices;
+        }
+
+        virtual StorageKind Kind() const override { return StorageKind::Archetype; }
+
+        virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
+        {
+            ArchetypeSignature signature;
+            signature.set(m_TypeID);
+
+            m_Archetypes.ForEachChunk(signature, [&](const Archetype& archetype, uint32_t chunk, uint32_t count)
+            {
+                T* column = (T*)archetype.Column(chunk, m_TypeID);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    callback((void*)&column[i]);
+                }
+            });
+        }
+
+        virtual void Clear() override
+        {
+            for (Entity e : m_Indices)
+            {
+                m_Archetypes.Remove(e, m_TypeID);
+                m_Positions[EntityIndex(e)] = UINT32_MAX;
+            }
+
+            m_Indices.clear();
+            m_Mask.clear();
+
+            NotifyClear();
+        }
+
+        ArchetypeStorage& Archetypes() const { return m_Archetypes; }
+
+        // Calls func(T*, size_t) for the column of each chunk holding T, in chunk order.
+        template<typename Func>
+        void ForEachBlock(Func&& func)
+        {
+            ArchetypeSignature signature;
+            signature.set(m_TypeID);
+
+            m_Archetypes.ForEachChunk(signature, [&](const Archetype& archetype, uint32_t chunk, uint32_t count)
+            {
+                func((T*)archetype.Column(chunk, m_TypeID), (size_t)count);
+            });
+        }
+
+    private:
+        ArchetypeStorage& m_Archetypes;
+        uint8_t m_TypeID;
+        ComponentMaskAVX m_Mask;
+        std::vector<Entity> m_Indices;
+        std::vector<uint32_t> m_Positions;
+    };
+}
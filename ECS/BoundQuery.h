@@ -0,0 +1,67 @@
+#pragma once
+
+#include "QueryPlanner.h"
+
+namespace HBL2
+{
+    // A query together with a callable of its own type, returned by the template ForEach overloads.
+    // The callable is called directly from the query loop instead of through std::function, so it
+    // inlines and captured state is never heap allocated, also from the Dispatch() jobs. Schedule()
+    // copies it into the system's task, which is the only place it is type-erased.
+    template<typename TQuery, typename Func>
+    class BoundQuery
+    {
+    public:
+        BoundQuery(TQuery&& query, Func&& func)
+            : m_Query(std::move(query)), m_Function(std::move(func))
+        {
+        }
+
+        BoundQuery(TQuery&& query, const Func& func)
+            : m_Query(std::move(query)), m_Function(func)
+        {
+        }
+
+        void Run()
+        {
+            m_Query.RunWith(m_Function);
+        }
+
+        // Forwards the query's Dispatch arguments, e.g. the grain size of a ViewQuery.
+        template<typename... Args>
+        void Dispatch(Args&&... args)
+        {
+            m_Query.DispatchWith(m_Function, std::forward<Args>(args)...);
+        }
+
+        // Without arguments the query is recorded as a system, see Registry::ExecuteScheduledSystems.
+        // ViewQuery also takes a JobContext to queue its jobs on, the BoundQuery must outlive them.
+        template<typename... Args>
+        void Schedule(Args&&... args)
+        {
+            m_Query.ScheduleWith(m_Function, std::forward<Args>(args)...);
+        }
+
+        QueryPlan Explain()
+        {
+            return m_Query.Explain();
+        }
+
+        QueryPlan Analyze()
+        {
+            return m_Query.AnalyzeWith(m_Function);
+        }
+
+        // The excluding query, bound to the same callable.
+        template<typename... ExcludeTypes>
+        auto Exclude()
+        {
+            using ExcludedQuery = decltype(m_Query.template Exclude<ExcludeTypes...>());
+            return BoundQuery<ExcludedQuery, Func>(m_Query.template Exclude<ExcludeTypes...>(), std::move(m_Function));
+        }
+
+    private:
+        TQuery m_Query;
+        Func m_Function;
+    };
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "EntityManager.h"
+#include "IComponentStorage.h"
+#include "TagComponentStorage.h"
+#include "../Utilities/JobSystem.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace HBL2
+{
+    // One buffer per job system worker, plus one shared by the threads that are not workers.
+    constexpr uint32_t MAX_COMMAND_BUFFERS = 256;
+
+    enum class CommandType : uint8_t
+    {
+        Create,
+        Add,
+        Remove,
+        Destroy,
+    };
+
+    // A recorded structural change. Add commands own a payload of the component type, moved into
+    // the storage on playback or destroyed when the command is dropped.
+    struct Command
+    {
+        uint64_t Order;     // Buffer index in the high bits, recording order in the low bits
+        Entity Target;
+        CommandType Type;
+        uint8_t TypeID;
+        void* Payload = nullptr;
+
+        void (*Construct)(void* dst, void* src, bool constructed) = nullptr;
+        void (*Discard)(void* src) = nullptr;
+        void (*CreateStorage)(IComponentStorage*& slot) = nullptr;
+    };
+
+    // Records structural changes from inside a query or job, to be applied by Registry::PlaybackCommands.
+    // A buffer is only ever written by one thread, use Registry::GetCommandBuffer to get the calling thread's one.
+    class CommandBuffer
+    {
+    public:
+        CommandBuffer(EntityManager* entities, uint32_t index)
+            : m_Entities(entities), m_Index(index)
+        {
+        }
+
+        ~CommandBuffer()
+        {
+            Clear();
+        }
+
+        CommandBuffer(const CommandBuffer&) = delete;
+        CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+        // The handle comes from the lock free entity manager and can be used by later commands right away,
+        // the entity only counts towards Registry::GetEntityCount after playback. NO_ENTITY once the
+        // entity capacity is exhausted, nothing is recorded then.
+        Entity CreateEntity()
+        {
+            Entity e = m_Entities->Create();
+            if (e != NO_ENTITY)
+            {
+                Record(CommandType::Create, e, 0);
+            }
+            return e;
+        }
+
+        void DestroyEntity(Entity e)
+        {
+            Record(CommandType::Destroy, e, 0);
+        }
+
+        template<typename T>
+        void AddComponent(Entity e, const T& comp = {})
+        {
+            EmplaceComponent<T>(e, comp);
+        }
+
+        template<typename T>
+        void AddComponent(Entity e, T&& comp)
+        {
+            EmplaceComponent<std::decay_t<T>>(e, std::forward<T>(comp));
+        }
+
+        // Replaces the component if the entity already has one when the command is played back.
+        template<typename T, typename... Args>
+        void EmplaceComponent(Entity e, Args&&... args)
+        {
+            static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned components can not be recorded!");
+
+            Command& command = Record(CommandType::Add, e, ComponentTypeID::Get<T>());
+            command.Payload = new(Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+            command.Construct = [](void* dst, void* src, bool constructed)
+            {
+                if (constructed)
+                {
+                    *(T*)dst = std::move(*(T*)src);
+                }
+                else
+                {
+                    new(dst) T(std::move(*(T*)src));
+                }
+                ((T*)src)->~T();
+            };
+            command.Discard = [](void* src) { ((T*)src)->~T(); };
+            command.CreateStorage = [](IComponentStorage*& slot) { slot = (IComponentStorage*)new DefaultComponentStorage<T>(); };
+        }
+
+        template<typename T>
+        void RemoveComponent(Entity e)
+        {
+            Record(CommandType::Remove, e, ComponentTypeID::Get<T>());
+        }
+
+        bool Empty() const { return m_Commands.empty(); }
+        size_t Size() const { return m_Commands.size(); }
+
+        std::vector<Command>& Commands() { return m_Commands; }
+
+        // Drops the recorded commands, payloads that were not played back are destroyed.
+        void Clear()
+        {
+            for (Command& command : m_Commands)
+            {
+                if (command.Payload)
+                {
+                    command.Discard(command.Payload);
+                }
+            }
+
+            m_Commands.clear();
+            m_Pages.clear();
+            m_PageOffset = PAGE_BYTES;
+            m_Sequence = 0;
+        }
+
+    private:
+        static constexpr size_t PAGE_BYTES = 16 * 1024;
+
+        Command& Record(CommandType type, Entity e, uint8_t typeID)
+        {
+            Command& command = m_Commands.emplace_back();
+            command.Order = ((uint64_t)m_Index << 32) | m_Sequence++;
+            command.Target = e;
+            command.Type = type;
+            command.TypeID = typeID;
+            return command;
+        }
+
+        // Payloads live in pages that never move, so recorded objects are never relocated by a reallocation.
+        void* Allocate(size_t size)
+        {
+            constexpr size_t align = alignof(std::max_align_t);
+            size = (size + align - 1) & ~(align - 1);
+
+            if (size > PAGE_BYTES)
+            {
+                m_Pages.emplace_back(new std::max_align_t[size / sizeof(std::max_align_t)]);
+                void* ptr = m_Pages.back().get();
+
+                // Keep filling the previous page, move the dedicated one behind it
+                if (m_Pages.size() > 1)
+                {
+                    std::swap(m_Pages[m_Pages.size() - 1], m_Pages[m_Pages.size() - 2]);
+                }
+                return ptr;
+            }
+
+            if (m_PageOffset + size > PAGE_BYTES)
+            {
+                m_Pages.emplace_back(new std::max_align_t[PAGE_BYTES / sizeof(std::max_align_t)]);
+                m_PageOffset = 0;
+            }
+
+            void* ptr = (std::byte*)m_Pages.back().get() + m_PageOffset;
+            m_PageOffset += size;
+            return ptr;
+        }
+
+    private:
+        EntityManager* m_Entities;
+        uint32_t m_Index;
+        uint32_t m_Sequence = 0;
+
+        std::vector<Command> m_Commands;
+        std::vector<std::unique_ptr<std::max_align_t[]>> m_Pages;
+        size_t m_PageOffset = PAGE_BYTES;
+    };
+
+    // The per thread command buffers of a registry, created on first use by each thread.
+    class CommandBuffers
+    {
+    public:
+        explicit CommandBuffers(EntityManager* entities)
+            : m_Entities(entities)
+        {
+        }
+
+        ~CommandBuffers()
+        {
+            for (std::atomic<CommandBuffer*>& slot : m_Buffers)
+            {
+                delete slot.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Workers get their own buffer, every other thread shares the last one and must not record
+        // concurrently with another non worker thread. Buffers are created on first use and published
+        // with a CAS, so threads racing for the shared one all end up with the same buffer.
+        CommandBuffer& Local()
+        {
+            int32_t worker = JobSystem::Get().GetWorkerIndex();
+            HBL2_CORE_ASSERT(worker < (int32_t)MAX_COMMAND_BUFFERS - 1, "Too many job system workers for the command buffers!");
+            uint32_t index = worker >= 0 ? (uint32_t)worker : MAX_COMMAND_BUFFERS - 1;
+
+            CommandBuffer* buffer = m_Buffers[index].load(std::memory_order_acquire);
+            if (!buffer)
+            {
+                CommandBuffer* fresh = new CommandBuffer(m_Entities, index);
+                if (m_Buffers[index].compare_exchange_strong(buffer, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    buffer = fresh;
+                }
+                else
+                {
+                    // Another thread published first, buffer now holds its one
+                    delete fresh;
+                }
+            }
+            return *buffer;
+        }
+
+        template<typename Func>
+        void ForEach(Func&& func)
+        {
+            for (std::atomic<CommandBuffer*>& slot : m_Buffers)
+            {
+                if (CommandBuffer* buffer = slot.load(std::memory_order_acquire))
+                {
+                    func(*buffer);
+                }
+            }
+        }
+
+    private:
+        EntityManager* m_Entities;
+        std::atomic<CommandBuffer*> m_Buffers[MAX_COMMAND_BUFFERS] = {};
+    };
+}
@@ -3,59 +3,253 @@
 #include "EntityManager.h"
 
 #include <immintrin.h>
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <new>
 
 namespace HBL2
 {
+    // Entity bitset that grows on demand with the highest entity index set in it,
+    // so a component owned by a handful of low index entities only costs a few words.
+    // The word count is always a multiple of MASK_WORD_GRANULARITY to keep the AVX2 loops simple.
+    //
+    // A summary level keeps one bit per data word (set <=> word != 0), kept up to date by set/reset.
+    // AND, AND-NOT, count and iteration walk the summary and only touch occupied words, so sparse
+    // masks cost in proportion to their occupied words, not to the world size.
     struct ComponentMaskAVX
     {
-        alignas(32) uint64_t data[MASK_WORDS];
+        uint64_t* data = nullptr;
+        uint64_t* summary = nullptr;
+        size_t words = 0;
 
-        ComponentMaskAVX() { clear(); }
+        ComponentMaskAVX() = default;
+
+        ComponentMaskAVX(const ComponentMaskAVX& other)
+        {
+            *this = other;
+        }
+
+        ComponentMaskAVX(ComponentMaskAVX&& other) noexcept
+            : data(other.data), summary(other.summary), words(other.words)
+        {
+            other.data = nullptr;
+            other.summary = nullptr;
+            other.words = 0;
+        }
+
+        ~ComponentMaskAVX()
+        {
+            Free();
+        }
+
+        ComponentMaskAVX& operator=(const ComponentMaskAVX& other)
+        {
+            if (this == &other)
+            {
+                return *this;
+            }
+
+            if (words < other.words)
+            {
+                Free();
+                Allocate(other.words);
+            }
+            else
+            {
+                clear();
+            }
+
+            // Copy only the occupied words
+            for (size_t si = 0, n = SummaryWords(other.words); si < n; ++si)
+            {
+                uint64_t s = other.summary[si];
+                summary[si] = s;
+                while (s)
+                {
+                    size_t wi = si * 64 + BitScanForward(s);
+                    data[wi] = other.data[wi];
+                    s &= s - 1;
+                }
+            }
+
+            return *this;
+        }
+
+        ComponentMaskAVX& operator=(ComponentMaskAVX&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Free();
+                data = other.data;
+                summary = other.summary;
+                words = other.words;
+                other.data = nullptr;
+                other.summary = nullptr;
+                other.words = 0;
+            }
+
+            return *this;
+        }
 
         void clear()
         {
-            for (size_t i = 0; i < MASK_WORDS; ++i)
+            for (size_t si = 0, n = SummaryWords(words); si < n; ++si)
             {
-                data[i] = 0ULL;
+                uint64_t s = summary[si];
+                while (s)
+                {
+                    data[si * 64 + BitScanForward(s)] = 0ULL;
+                    s &= s - 1;
+                }
+                summary[si] = 0ULL;
             }
         }
 
+        // Makes room for entity indices below 'entityCount' up front, so set() never grows in a hot path.
+        void reserve(size_t entityCount)
+        {
+            size_t needed = (entityCount + 63) / 64;
+            if (needed > words)
+            {
+                Grow(needed);
+            }
+        }
+
+        // Number of entity indices covered by the current allocation.
+        size_t capacity() const { return words * 64; }
+
         void set(Entity e)
         {
-            size_t idx = e >> 6;
-            uint64_t bit = 1ULL << (e & 63);
+            uint32_t index = EntityIndex(e);
+            size_t idx = index >> 6;
+            uint64_t bit = 1ULL << (index & 63);
+
+            if (idx >= words)
+            {
+                Grow(idx + 1);
+            }
+
             data[idx] |= bit;
+            summary[idx >> 6] |= 1ULL << (idx & 63);
+        }
+
+        // Sets the bits of many entities, growing once. Runs of entities falling in the same word
+        // are collected and written with a single OR, so consecutive indices cost one store per 64.
+        void set_many(const Entity* entities, size_t count)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+
+            uint32_t highest = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                highest = std::max(highest, EntityIndex(entities[i]));
+            }
+
+            if ((highest >> 6) >= words)
+            {
+                Grow((highest >> 6) + 1);
+            }
+
+            size_t word = EntityIndex(entities[0]) >> 6;
+            uint64_t bits = 0ULL;
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t index = EntityIndex(entities[i]);
+                if ((index >> 6) != word)
+                {
+                    data[word] |= bits;
+                    summary[word >> 6] |= 1ULL << (word & 63);
+                    word = index >> 6;
+                    bits = 0ULL;
+                }
+                bits |= 1ULL << (index & 63);
+            }
+
+            data[word] |= bits;
+            summary[word >> 6] |= 1ULL << (word & 63);
         }
 
         void reset(Entity e)
         {
-            size_t idx = e >> 6;
-            uint64_t bit = 1ULL << (e & 63);
-            data[idx] &= ~bit;
+            uint32_t index = EntityIndex(e);
+            size_t idx = index >> 6;
+            uint64_t bit = 1ULL << (index & 63);
+
+            if (idx < words)
+            {
+                data[idx] &= ~bit;
+                if (data[idx] == 0)
+                {
+                    summary[idx >> 6] &= ~(1ULL << (idx & 63));
+                }
+            }
+        }
+
+        // Clears the bits of many entities with one read-modify-write per run of entities sharing a word,
+        // sorted entities touch every word once.
+        void reset_many(const Entity* entities, size_t count)
+        {
+            size_t i = 0;
+            while (i < count)
+            {
+                size_t word = EntityIndex(entities[i]) >> 6;
+                uint64_t bits = 0ULL;
+                for (; i < count && (EntityIndex(entities[i]) >> 6) == word; ++i)
+                {
+                    bits |= 1ULL << (EntityIndex(entities[i]) & 63);
+                }
+
+                if (word < words)
+                {
+                    data[word] &= ~bits;
+                    if (data[word] == 0)
+                    {
+                        summary[word >> 6] &= ~(1ULL << (word & 63));
+                    }
+                }
+            }
         }
 
         bool test(Entity e) const
         {
-            size_t idx = e >> 6;
-            uint64_t bit = 1ULL << (e & 63);
-            return (data[idx] & bit) != 0;
+            uint32_t index = EntityIndex(e);
+            size_t idx = index >> 6;
+            uint64_t bit = 1ULL << (index & 63);
+            return idx < words && (data[idx] & bit) != 0;
+        }
+
+        bool any() const
+        {
+            for (size_t si = 0, n = SummaryWords(words); si < n; ++si)
+            {
+                if (summary[si])
+                {
+                    return true;
+                }
+            }
+
+            return false;
         }
 
         // Optimize mask comparison operations
         bool has_any(const ComponentMaskAVX& other) const
         {
-            for (size_t i = 0; i < MASK_WORDS; i += 4)
+            for (size_t si = 0, n = SummaryWords(std::min(words, other.words)); si < n; ++si)
             {
-                __m256i a = _mm256_load_si256((__m256i*) & data[i]);
-                __m256i b = _mm256_load_si256((__m256i*) & other.data[i]);
-                __m256i c = _mm256_and_si256(a, b);
-
-                // Quick check if any bits are set
-                if (!_mm256_testz_si256(c, c))
+                uint64_t s = summary[si] & other.summary[si];
+                while (s)
                 {
-                    return true;
+                    size_t wi = si * 64 + BitScanForward(s);
+                    if (data[wi] & other.data[wi])
+                    {
+                        return true;
+                    }
+                    s &= s - 1;
                 }
             }
 
@@ -64,23 +258,76 @@ namespace HBL2
 
         void and_with(const ComponentMaskAVX& other)
         {
-            for (size_t i = 0; i < MASK_WORDS; i += 4)
+            size_t common = SummaryWords(std::min(words, other.words));
+
+            for (size_t si = 0; si < common; ++si)
+            {
+                uint64_t mine = summary[si];
+                uint64_t both = mine & other.summary[si];
+
+                // Words only occupied here become zero
+                uint64_t drop = mine & ~both;
+                while (drop)
+                {
+                    data[si * 64 + BitScanForward(drop)] = 0ULL;
+                    drop &= drop - 1;
+                }
+
+                if (both == ~0ULL)
+                {
+                    // Fully occupied block on both sides, AND all 64 words with AVX2
+                    for (size_t i = si * 64, end = i + 64; i < end; i += 4)
+                    {
+                        __m256i a = _mm256_load_si256((__m256i*) & data[i]);
+                        __m256i b = _mm256_load_si256((__m256i*) & other.data[i]);
+                        _mm256_store_si256((__m256i*) & data[i], _mm256_and_si256(a, b));
+                    }
+
+                    summary[si] = RebuildSummary(si);
+                    continue;
+                }
+
+                uint64_t result = 0ULL;
+                while (both)
+                {
+                    unsigned bit = BitScanForward(both);
+                    size_t wi = si * 64 + bit;
+                    data[wi] &= other.data[wi];
+                    result |= (uint64_t)(data[wi] != 0) << bit;
+                    both &= both - 1;
+                }
+                summary[si] = result;
+            }
+
+            // Blocks the other mask does not cover are zero there
+            for (size_t si = common, n = SummaryWords(words); si < n; ++si)
             {
-                __m256i a = _mm256_load_si256((__m256i*) & data[i]);
-                __m256i b = _mm256_load_si256((__m256i*) & other.data[i]);
-                __m256i c = _mm256_and_si256(a, b);
-                _mm256_store_si256((__m256i*) & data[i], c);
+                uint64_t s = summary[si];
+                while (s)
+                {
+                    data[si * 64 + BitScanForward(s)] = 0ULL;
+                    s &= s - 1;
+                }
+                summary[si] = 0ULL;
             }
         }
 
         void and_not_with(const ComponentMaskAVX& other)
         {
-            for (size_t i = 0; i < MASK_WORDS; i += 4)
+            for (size_t si = 0, n = SummaryWords(std::min(words, other.words)); si < n; ++si)
             {
-                __m256i m = _mm256_load_si256((__m256i*) & data[i]);
-                __m256i ex = _mm256_load_si256((__m256i*) & other.data[i]);
-                __m256i res = _mm256_andnot_si256(ex, m);
-                _mm256_store_si256((__m256i*) & data[i], res);
+                uint64_t both = summary[si] & other.summary[si];
+                while (both)
+                {
+                    unsigned bit = BitScanForward(both);
+                    size_t wi = si * 64 + bit;
+                    data[wi] &= ~other.data[wi];
+                    if (data[wi] == 0)
+                    {
+                        summary[si] &= ~(1ULL << bit);
+                    }
+                    both &= both - 1;
+                }
             }
         }
 
@@ -98,34 +345,35 @@ namespace HBL2
         size_t count() const
         {
             size_t total = 0;
-            for (size_t i = 0; i < MASK_WORDS; ++i)
+            for (size_t si = 0, n = SummaryWords(words); si < n; ++si)
             {
-                total += _mm_popcnt_u64(data[i]);
+                uint64_t s = summary[si];
+                while (s)
+                {
+                    total += _mm_popcnt_u64(data[si * 64 + BitScanForward(s)]);
+                    s &= s - 1;
+                }
             }
 
             return total;
         }
 
-        // Find the first set bit, or MAX_ENTITIES if none
-        Entity find_first() const
+        // Number of non-zero data words, read from the summary only
+        size_t occupied_words() const
         {
-            for (size_t wi = 0; wi < MASK_WORDS; ++wi)
+            size_t total = 0;
+            for (size_t si = 0, n = SummaryWords(words); si < n; ++si)
             {
-                uint64_t w = data[wi];
-                if (w)
-                {
-                    // count trailing zeros to find LSB
-#ifdef _MSC_VER
-                    unsigned long tz;
-                    _BitScanForward64(&tz, w);
-#else
-                    unsigned tz = __builtin_ctzll(w);
-#endif
-                    Entity e = static_cast<Entity>(wi * 64 + tz);
-                    return (e < MAX_ENTITIES ? e : MAX_ENTITIES);
-                }
+                total += _mm_popcnt_u64(summary[si]);
             }
-            return MAX_ENTITIES;
+
+            return total;
+        }
+
+        // Find the first set bit, or MAX_ENTITIES if none
+        Entity find_first() const
+        {
+            return find_from(0);
         }
 
         // Find the next set bit after 'prev', or MAX_ENTITIES if none
@@ -134,41 +382,7 @@ namespace HBL2
             Entity next = prev + 1;
             if (next >= MAX_ENTITIES) return MAX_ENTITIES;
 
-            size_t wi = next >> 6;
-            uint64_t bit_off = next & 63;
-
-            // Mask off bits below bit_off in the first word
-            uint64_t w = data[wi] & (~0ULL << bit_off);
-            if (w)
-            {
-#ifdef _MSC_VER
-                unsigned long tz;
-                _BitScanForward64(&tz, w);
-#else
-                unsigned tz = __builtin_ctzll(w);
-#endif
-                Entity e = static_cast<Entity>(wi * 64 + tz);
-                return (e < MAX_ENTITIES ? e : MAX_ENTITIES);
-            }
-
-            // Scan remaining words
-            for (size_t wj = wi + 1; wj < MASK_WORDS; ++wj)
-            {
-                uint64_t w2 = data[wj];
-                if (w2)
-                {
-#ifdef _MSC_VER
-                    unsigned long tz;
-                    _BitScanForward64(&tz, w2);
-#else
-                    unsigned tz = __builtin_ctzll(w2);
-#endif
-                    Entity e = static_cast<Entity>(wj * 64 + tz);
-                    return (e < MAX_ENTITIES ? e : MAX_ENTITIES);
-                }
-            }
-
-            return MAX_ENTITIES;
+            return find_from(next);
         }
 
         struct Iterator
@@ -209,5 +423,107 @@ namespace HBL2
         {
             return Iterator(this, MAX_ENTITIES);
         }
+
+    private:
+        // Find the first set bit at or after 'from', skipping empty words through the summary
+        Entity find_from(Entity from) const
+        {
+            size_t wi = from >> 6;
+            if (wi >= words) return MAX_ENTITIES;
+
+            // Mask off bits below the start in the first word
+            uint64_t w = data[wi] & (~0ULL << (from & 63));
+            if (w)
+            {
+                Entity e = static_cast<Entity>(wi * 64 + BitScanForward(w));
+                return (e < MAX_ENTITIES ? e : MAX_ENTITIES);
+            }
+
+            // Next occupied word, first within the current summary word, then across summary words
+            size_t si = wi >> 6;
+            uint64_t bitOff = (wi & 63) + 1;
+            uint64_t s = bitOff < 64 ? (summary[si] & (~0ULL << bitOff)) : 0ULL;
+
+            for (size_t n = SummaryWords(words); !s; s = summary[si])
+            {
+                if (++si >= n) return MAX_ENTITIES;
+            }
+
+            size_t wj = si * 64 + BitScanForward(s);
+            Entity e = static_cast<Entity>(wj * 64 + BitScanForward(data[wj]));
+            return (e < MAX_ENTITIES ? e : MAX_ENTITIES);
+        }
+
+        static size_t SummaryWords(size_t dataWords)
+        {
+            return (dataWords + 63) >> 6;
+        }
+
+        static unsigned BitScanForward(uint64_t w)
+        {
+#ifdef _MSC_VER
+            unsigned long tz;
+            _BitScanForward64(&tz, w);
+            return (unsigned)tz;
+#else
+            return (unsigned)__builtin_ctzll(w);
+#endif
+        }
+
+        uint64_t RebuildSummary(size_t si) const
+        {
+            uint64_t s = 0ULL;
+            for (size_t bit = 0; bit < 64; ++bit)
+            {
+                s |= (uint64_t)(data[si * 64 + bit] != 0) << bit;
+            }
+            return s;
+        }
+
+        void Allocate(size_t count)
+        {
+            // Round to whole summary words so fully occupied blocks can always be processed 64 words at a time
+            size_t allocated = SummaryWords(count) * 64;
+
+            data = (uint64_t*)::operator new(allocated * sizeof(uint64_t), std::align_val_t(32));
+            summary = new uint64_t[SummaryWords(count)];
+            words = count;
+
+            std::memset(data, 0, allocated * sizeof(uint64_t));
+            std::memset(summary, 0, SummaryWords(count) * sizeof(uint64_t));
+        }
+
+        void Free()
+        {
+            if (data)
+            {
+                ::operator delete(data, std::align_val_t(32));
+                delete[] summary;
+                data = nullptr;
+                summary = nullptr;
+                words = 0;
+            }
+        }
+
+        // Grows geometrically so a stream of increasing entity indices stays amortized O(1).
+        void Grow(size_t needed)
+        {
+            size_t count = std::max(needed, words * 2);
+            count = (count + MASK_WORD_GRANULARITY - 1) & ~(MASK_WORD_GRANULARITY - 1);
+            count = std::min<size_t>(count, MASK_WORDS);
+
+            uint64_t* oldData = data;
+            uint64_t* oldSummary = summary;
+            size_t oldWords = words;
+
+            Allocate(count);
+            if (oldData)
+            {
+                std::memcpy(data, oldData, oldWords * sizeof(uint64_t));
+                std::memcpy(summary, oldSummary, SummaryWords(oldWords) * sizeof(uint64_t));
+                ::operator delete(oldData, std::align_val_t(32));
+                delete[] oldSummary;
+            }
+        }
     };
-}
\ No newline at end of file
+}
@@ -2,14 +2,40 @@
 
 #include <vector>
 #include <atomic>
+#include <algorithm>
 
 namespace HBL2
 {
-    constexpr uint32_t MAX_COMPONENT_TYPES = 128;
-    constexpr uint32_t MAX_ENTITIES = 262144;
-    constexpr uint32_t MASK_WORDS = (MAX_ENTITIES + 63) / 64;
     using Entity = uint32_t;
 
+    // Never a live handle, its index is past every possible capacity. Returned when creation fails.
+    static constexpr Entity NO_ENTITY = UINT32_MAX;
+
+    // An entity handle packs the slot index (low bits) with the slot generation (high bits).
+    // Storages are keyed by the index, the generation only tells stale handles apart.
+    constexpr uint32_t ENTITY_INDEX_BITS = 22;
+    constexpr uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+    constexpr uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+
+    // Compile time capacity policy: the hard upper bound of entity indices, also used as the
+    // end sentinel of mask iteration. Masks and sparse tables only grow up to the highest index
+    // actually used, so a large bound costs nothing for small worlds. Define HBL2_ECS_MAX_ENTITIES
+    // to lower it, and use Registry::SetEntityCapacity for a per world runtime limit.
+#ifdef HBL2_ECS_MAX_ENTITIES
+    constexpr uint32_t MAX_ENTITIES = HBL2_ECS_MAX_ENTITIES;
+#else
+    constexpr uint32_t MAX_ENTITIES = ENTITY_INDEX_MASK;
+#endif
+    static_assert(MAX_ENTITIES <= ENTITY_INDEX_MASK, "MAX_ENTITIES does not fit in the entity index bits!");
+
+    constexpr uint32_t MAX_COMPONENT_TYPES = 128;
+    constexpr uint32_t MASK_WORD_GRANULARITY = 8; // Masks grow in 512 bit steps
+    constexpr uint32_t MASK_WORDS = ((MAX_ENTITIES + 63) / 64 + MASK_WORD_GRANULARITY - 1) & ~(MASK_WORD_GRANULARITY - 1);
+
+    inline uint32_t EntityIndex(Entity e) { return e & ENTITY_INDEX_MASK; }
+    inline uint32_t EntityGeneration(Entity e) { return e >> ENTITY_INDEX_BITS; }
+    inline Entity MakeEntity(uint32_t index, uint32_t generation) { return (generation << ENTITY_INDEX_BITS) | index; }
+
     struct ComponentTypeID
     {
         template<typename T>
@@ -28,33 +54,222 @@ namespace HBL2
         static inline uint8_t s_Counter = 0;
     };
 
+    // Generation and free list link of one entity slot.
+    struct EntitySlot
+    {
+        std::atomic<uint16_t> Generation{ 0 };
+        std::atomic<uint32_t> Next{ 0 };
+    };
+
+    constexpr uint32_t ENTITY_PAGE_SHIFT = 12;
+    constexpr uint32_t ENTITY_PAGE_SIZE = 1u << ENTITY_PAGE_SHIFT;
+    constexpr uint32_t ENTITY_PAGE_COUNT = (MAX_ENTITIES + ENTITY_PAGE_SIZE - 1) >> ENTITY_PAGE_SHIFT;
+
+    // Lock free entity allocator, Create and Destroy may be called from any thread.
+    //
+    // Slots live in pages that are published once with a CAS and never move, so readers never see a
+    // reallocation. Destroyed slots go on a Treiber stack whose head carries an ABA tag next to the
+    // slot index, fresh slots come from an atomic high water mark that never passes the capacity.
+    // Slots keep their generation for the lifetime of the manager, Clear bumps it like Destroy does,
+    // so handles from before a Clear stay stale.
     class EntityManager
     {
     public:
+        EntityManager() = default;
+
+        ~EntityManager()
+        {
+            FreePages();
+        }
+
+        EntityManager(const EntityManager&) = delete;
+        EntityManager& operator=(const EntityManager&) = delete;
+
+        // Returns NO_ENTITY once the capacity is exhausted.
         Entity Create()
         {
-            if (!m_FreeList.empty())
+            uint32_t index;
+            if (PopFree(index))
+            {
+                return MakeEntity(index, SlotAt(index).Generation.load(std::memory_order_relaxed));
+            }
+
+            if (ReserveFresh(1, index) == 0)
+            {
+                return NO_ENTITY;
+            }
+
+            EnsurePage(index);
+            return MakeEntity(index, SlotAt(index).Generation.load(std::memory_order_relaxed));
+        }
+
+        // Creates up to count entities into out, recycled slots first, then one contiguous range of fresh
+        // indices reserved with a single CAS. Returns the number created, less than count only when the
+        // capacity is exhausted, the remaining handles of out are set to NO_ENTITY.
+        uint32_t Create(uint32_t count, Entity* out)
+        {
+            uint32_t created = 0;
+            uint32_t index;
+            while (created < count && PopFree(index))
+            {
+                out[created++] = MakeEntity(index, SlotAt(index).Generation.load(std::memory_order_relaxed));
+            }
+
+            if (created == count)
+            {
+                return count;
+            }
+
+            uint32_t first;
+            uint32_t fresh = ReserveFresh(count - created, first);
+
+            for (index = first; index < first + fresh; ++index)
             {
-                Entity e = m_FreeList.back();
-                m_FreeList.pop_back();
-                return e;
+                if (index == first || (index & (ENTITY_PAGE_SIZE - 1)) == 0)
+                {
+                    EnsurePage(index);
+                }
+                out[created++] = MakeEntity(index, SlotAt(index).Generation.load(std::memory_order_relaxed));
             }
-            return m_NextId++;
+
+            for (uint32_t i = created; i < count; ++i)
+            {
+                out[i] = NO_ENTITY;
+            }
+
+            return created;
         }
 
         void Destroy(Entity e)
         {
-            m_FreeList.push_back(e);
+            uint32_t index = EntityIndex(e);
+            EntitySlot& slot = SlotAt(index);
+            slot.Generation.store((slot.Generation.load(std::memory_order_relaxed) + 1) & ENTITY_GENERATION_MASK, std::memory_order_relaxed);
+            PushFree(index);
+        }
+
+        // O(1), a single read from the slot page.
+        bool IsAlive(Entity e) const
+        {
+            uint32_t index = EntityIndex(e);
+            if (index >= m_NextId.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            EntitySlot* page = m_Pages[index >> ENTITY_PAGE_SHIFT].load(std::memory_order_acquire);
+            return page && page[index & (ENTITY_PAGE_SIZE - 1)].Generation.load(std::memory_order_relaxed) == EntityGeneration(e);
         }
 
+        // Runtime capacity policy, caps the number of entity slots.
+        void SetCapacity(uint32_t capacity)
+        {
+            HBL2_CORE_ASSERT(capacity <= MAX_ENTITIES, "Entity capacity exceeds MAX_ENTITIES!");
+            m_Capacity = capacity;
+        }
+
+        uint32_t GetCapacity() const { return m_Capacity; }
+
+        // One past the highest entity index handed out so far.
+        uint32_t GetHighWaterMark() const { return m_NextId.load(); }
+
+        // Not thread safe. Every slot handed out so far gets a new generation, the pages are kept
+        // and fresh indices are handed out from 0 again.
         void Clear()
         {
-            m_FreeList.clear();
+            for (uint32_t index = 0, end = m_NextId.load(); index < end; ++index)
+            {
+                EntitySlot& slot = SlotAt(index);
+                slot.Generation.store((slot.Generation.load(std::memory_order_relaxed) + 1) & ENTITY_GENERATION_MASK, std::memory_order_relaxed);
+            }
+
+            m_FreeHead.store(0);
             m_NextId.store(0);
         }
 
     private:
-        std::vector<Entity> m_FreeList;
+        EntitySlot& SlotAt(uint32_t index) const
+        {
+            return m_Pages[index >> ENTITY_PAGE_SHIFT].load(std::memory_order_acquire)[index & (ENTITY_PAGE_SIZE - 1)];
+        }
+
+        // Takes up to count fresh indices starting at first, never moving the high water mark past the capacity.
+        uint32_t ReserveFresh(uint32_t count, uint32_t& first)
+        {
+            first = m_NextId.load(std::memory_order_relaxed);
+            uint32_t reserved;
+            do
+            {
+                reserved = first < m_Capacity ? std::min(count, m_Capacity - first) : 0;
+                if (reserved == 0)
+                {
+                    return 0;
+                }
+            }
+            while (!m_NextId.compare_exchange_weak(first, first + reserved, std::memory_order_relaxed));
+
+            return reserved;
+        }
+
+        void EnsurePage(uint32_t index)
+        {
+            std::atomic<EntitySlot*>& page = m_Pages[index >> ENTITY_PAGE_SHIFT];
+            if (page.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            // Racing creators may both allocate, the loser frees its page
+            EntitySlot* fresh = new EntitySlot[ENTITY_PAGE_SIZE];
+            EntitySlot* expected = nullptr;
+            if (!page.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                delete[] fresh;
+            }
+        }
+
+        void FreePages()
+        {
+            for (std::atomic<EntitySlot*>& page : m_Pages)
+            {
+                delete[] page.exchange(nullptr);
+            }
+        }
+
+        // The head packs an ABA tag (high 32 bits) with the top slot index + 1 (low 32 bits, 0 when empty).
+        void PushFree(uint32_t index)
+        {
+            EntitySlot& slot = SlotAt(index);
+            uint64_t head = m_FreeHead.load(std::memory_order_relaxed);
+            uint64_t next;
+            do
+            {
+                slot.Next.store((uint32_t)head, std::memory_order_relaxed);
+                next = (((head >> 32) + 1) << 32) | (uint64_t)(index + 1);
+            }
+            while (!m_FreeHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        bool PopFree(uint32_t& index)
+        {
+            uint64_t head = m_FreeHead.load(std::memory_order_acquire);
+            while ((uint32_t)head != 0)
+            {
+                uint32_t top = (uint32_t)head - 1;
+                uint64_t next = (((head >> 32) + 1) << 32) | SlotAt(top).Next.load(std::memory_order_relaxed);
+                if (m_FreeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    index = top;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::atomic<EntitySlot*> m_Pages[ENTITY_PAGE_COUNT] = {};
+        std::atomic<uint64_t> m_FreeHead{ 0 };
         std::atomic<uint32_t> m_NextId{ 0 };
+        uint32_t m_Capacity = MAX_ENTITIES;
     };
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 ﻿#pragma once
 
 #include "IComponentStorage.h"
+#include "TagComponentStorage.h"
+#include "QueryPlanner.h"
+#include "TypedStorage.h"
+#include "BoundQuery.h"
+#include "Scheduler.h"
 
 #include <utility>
 
@@ -19,77 +24,112 @@ namespace HBL2
 	class ExcludeQuery<IncludeWrapper<IncludeTypes...>, ExcludeWrapper<ExcludeTypes...>>
 	{
 	public:
-		ExcludeQuery(ComponentMaskAVX& queryMask, uint32_t entityCount, Span<IComponentStorage*> includes, StaticArray<IComponentStorage*, sizeof...(ExcludeTypes)> excludes)
-			: m_JointMask(queryMask), m_EntityCount(entityCount), m_Include(includes), m_Exclude(excludes)
+		using FunctionType = std::function<void(IncludeTypes&...)>;
+
+		ExcludeQuery(Scheduler* scheduler, const std::atomic<uint32_t>* entityCount, StaticArray<IComponentStorage*, sizeof...(IncludeTypes)> includes, StaticArray<IComponentStorage*, sizeof...(ExcludeTypes)> excludes)
+			: m_Include(includes), m_Exclude(excludes), m_Scheduler(scheduler), m_EntityCount(entityCount)
 		{
 		}
 
-		ExcludeQuery& ForEach(std::function<void(IncludeTypes&...)>&& func)
+		ExcludeQuery& ForEach(FunctionType&& func)
 		{
 			m_Function = std::move(func);
 			return *this;
 		}
 
+		// Binds any invocable by type, see BoundQuery.
+		template<typename Func> requires (!std::is_same_v<std::decay_t<Func>, FunctionType> && std::is_invocable_v<Func&, IncludeTypes&...>)
+		BoundQuery<ExcludeQuery, std::decay_t<Func>> ForEach(Func&& func)
+		{
+			return BoundQuery<ExcludeQuery, std::decay_t<Func>>(std::move(*this), std::forward<Func>(func));
+		}
+
 		void Run()
 		{
-			ForEachRunImpl(std::index_sequence_for<IncludeTypes...>{});
+			RunWith(m_Function);
 		}
 
-		void Schedule()
+		// The plan the next Run() would use, without running the query.
+		QueryPlan Explain()
+		{
+			return Plan();
+		}
+
+		// Runs the query and returns its plan with the measured cost next to the predicted one.
+		QueryPlan Analyze()
 		{
+			return AnalyzeWith(m_Function);
+		}
 
+		// Records the query as a system run by Registry::ExecuteScheduledSystems, in parallel with other
+		// systems whose component access does not conflict. Excluded components are only read.
+		void Schedule()
+		{
+			ScheduleWith(m_Function);
 		}
 
 		void Dispatch()
 		{
-            ForEachDispatchImpl(std::index_sequence_for<IncludeTypes...>{});
+			DispatchWith(m_Function);
 		}
 
 	private:
-        template<size_t... Indices>
-        void ForEachRunImpl(std::index_sequence<Indices...>)
-        {
-            constexpr size_t Arity = sizeof...(IncludeTypes);
+		template<typename, typename>
+		friend class BoundQuery;
 
-            // Gather counts for all include components
-            std::array<size_t, Arity> counts = { m_Include[Indices]->Indices().Size()... };
-            size_t minCount = counts[0];
-            size_t minIdx = 0;
-            for (size_t i = 1; i < Arity; ++i)
-            {
-                if (counts[i] < minCount)
-                {
-                    minCount = counts[i];
-                    minIdx = i;
-                }
-            }
+		template<typename Func>
+		void RunWith(Func& func)
+		{
+			ForEachRunImpl(Plan(), func, std::index_sequence_for<IncludeTypes...>{});
+		}
 
-            bool lowEntityCount = (m_EntityCount <= 1000);
-            bool mediumEntityCountLowDensity = (m_EntityCount > 1000 && m_EntityCount <= 10000 && minCount <= 1500);
-            bool mediumHighEntityCountLowDensity = (m_EntityCount > 10000 && m_EntityCount <= 20000 && minCount <= 3000);
+		template<typename Func>
+		void ScheduleWith(const Func& func)
+		{
+			SystemEntry entry;
+			FillSystemAccess<IncludeTypes..., const ExcludeTypes...>(entry);
 
-            if (lowEntityCount || mediumEntityCountLowDensity || mediumHighEntityCountLowDensity)
-            {
-                for (Entity e : m_Include[minIdx]->Indices())
-                {
-                    bool ok = (m_Include[Indices]->Has(e) && ...);
-                    if (!ok) continue;
+			entry.Task = [query = *this, func]() mutable
+			{
+				query.RunWith(func);
+			};
 
-                    bool exclude = false;
-                    for (size_t i = 0; i < sizeof...(ExcludeTypes); ++i)
-                    {
-                        if (m_Exclude[i]->Has(e))
-                        {
-                            exclude = true;
-                            break;
-                        }
-                    }
-                    if (exclude) continue;
+			m_Scheduler->Register(std::move(entry));
+		}
 
-                    m_Function((IncludeTypes&)*((IncludeTypes*)(m_Include[Indices]->Get(e)))...);
-                }
-            }
-            else
+		template<typename Func>
+		void DispatchWith(Func& func)
+		{
+			ForEachDispatchImpl(func, std::index_sequence_for<IncludeTypes...>{});
+		}
+
+		template<typename Func>
+		QueryPlan AnalyzeWith(Func& func)
+		{
+			using Clock = std::chrono::high_resolution_clock;
+
+			QueryPlan plan = Plan();
+
+			auto t0 = Clock::now();
+			plan.ActualMatches = ForEachRunImpl(plan, func, std::index_sequence_for<IncludeTypes...>{});
+			auto t1 = Clock::now();
+
+			plan.ActualNs = std::chrono::duration<double, std::nano>(t1 - t0).count();
+			return plan;
+		}
+
+        QueryPlan Plan()
+        {
+            return PlanQuery(m_Include, m_Exclude, m_EntityCount->load(std::memory_order_relaxed));
+        }
+
+        // Returns the number of matched entities.
+        template<typename Func, size_t... Indices>
+        size_t ForEachRunImpl(const QueryPlan& plan, Func& func, std::index_sequence<Indices...>)
+        {
+            bool addressable = AllAddressable<sizeof...(IncludeTypes)>(&m_Include[0]);
+
+            if (plan.Strategy != QueryStrategy::Probe || !addressable)
             {
                 // Build ANDed mask
                 m_JointMask = m_Include[0]->Mask();
@@ -103,17 +143,59 @@ namespace HBL2
                 {
                     m_JointMask -= m_Exclude[i]->Mask();
                 }
+            }
+
+            if (!addressable)
+            {
+                // SoA components only exist as copies
+                return RunGathered<QUERY_CHUNK_SIZE, IncludeTypes...>(&m_Include[0], m_JointMask, func);
+            }
 
-                for (Entity e : m_JointMask)
+            size_t matches = 0;
+
+            // Resolve the concrete storages once, the loops below are instantiated per storage kind
+            WithTypedStorages<std::remove_const_t<IncludeTypes>...>(&m_Include[0], [&](const auto&... storages)
+            {
+                if (plan.Strategy == QueryStrategy::Probe)
                 {
-                    m_Function((IncludeTypes&)*((IncludeTypes*)(m_Include[Indices]->Get(e)))...);
+                    for (Entity e : m_Include[plan.DrivingStorage]->Indices())
+                    {
+                        bool ok = (storages.Has(e) && ...);
+                        if (!ok) continue;
+
+                        bool exclude = false;
+                        for (size_t i = 0; i < sizeof...(ExcludeTypes); ++i)
+                        {
+                            if (m_Exclude[i]->Has(e))
+                            {
+                                exclude = true;
+                                break;
+                            }
+                        }
+                        if (exclude) continue;
+
+                        func((IncludeTypes&)storages.Get(e)...);
+                        matches++;
+                    }
                 }
-            }
+                else
+                {
+                    for (Entity e : m_JointMask)
+                    {
+                        func((IncludeTypes&)storages.Get(e)...);
+                        matches++;
+                    }
+                }
+            });
+
+            return matches;
         }
 
-        template<size_t... Indices>
-        void ForEachDispatchImpl(std::index_sequence<Indices...>)
+        template<typename Func, size_t... Indices>
+        void ForEachDispatchImpl(Func& func, std::index_sequence<Indices...>)
         {
+            HBL2_CORE_ASSERT(AllAddressable<sizeof...(IncludeTypes)>(&m_Include[0]), "SoA components can not be dispatched, use Run!");
+
             // Build ANDed mask
             m_JointMask = m_Include[0]->Mask();
             for (size_t i = 1; i < sizeof...(IncludeTypes); ++i)
@@ -138,7 +220,7 @@ namespace HBL2
                 m_JointMask,
                 m_Include,
                 std::max(32u, entityCount / (JobSystem::Get().GetThreadCount() * 4)), // Dynamic group size
-                m_Function,
+                func,
                 std::make_index_sequence<sizeof...(IncludeTypes)>{}
             );
 
@@ -147,10 +229,11 @@ namespace HBL2
         }
 
 	private:
-		Span<IComponentStorage*> m_Include;
+		StaticArray<IComponentStorage*, sizeof...(IncludeTypes)> m_Include;
 		StaticArray<IComponentStorage*, sizeof...(ExcludeTypes)> m_Exclude;
-		std::function<void(IncludeTypes&...)> m_Function;
-		ComponentMaskAVX& m_JointMask;
-		uint32_t m_EntityCount;
+		FunctionType m_Function;
+		ComponentMaskAVX m_JointMask;
+		Scheduler* m_Scheduler = nullptr;
+		const std::atomic<uint32_t>* m_EntityCount;
 	};
 }
\ No newline at end of file
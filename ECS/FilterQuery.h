@@ -2,6 +2,12 @@
 
 #include "IComponentStorage.h"
 #include "ExcludeQuery.h"
+#include "ArchetypeStorage.h"
+#include "QueryPlanner.h"
+#include "TypedStorage.h"
+#include "BoundQuery.h"
+#include "OwningGroup.h"
+#include "Scheduler.h"
 
 namespace HBL2
 {
@@ -9,8 +15,11 @@ namespace HBL2
     class FilterQuery
     {
     public:
-        FilterQuery(Span<IComponentStorage*> allStorages, uint32_t entityCount, StaticArray<IComponentStorage*, sizeof...(Components)> storages)
-            :m_AllStorages(allStorages), m_EntityCount(entityCount), m_Storages(storages)
+        using FunctionType = std::function<void(Components&...)>;
+
+        // entityCount is the registry's live count, read when the query is planned so that scheduled copies see the current one.
+        FilterQuery(Span<IComponentStorage*> allStorages, Scheduler* scheduler, const std::atomic<uint32_t>* entityCount, StaticArray<IComponentStorage*, sizeof...(Components)> storages)
+            : m_Storages(storages), m_AllStorages(allStorages), m_Scheduler(scheduler), m_EntityCount(entityCount)
         {
         }
 
@@ -18,83 +27,351 @@ namespace HBL2
         ExcludeQuery<IncludeWrapper<Components...>, ExcludeWrapper<ExcludeTypes...>> Exclude()
         {
             return ExcludeQuery<IncludeWrapper<Components...>, ExcludeWrapper<ExcludeTypes...>>
-                (m_JointMask, m_EntityCount, m_Storages, { EnsureArray<std::remove_const_t<ExcludeTypes>>()...});
+                (m_Scheduler, m_EntityCount, m_Storages, { EnsureArray<std::remove_const_t<ExcludeTypes>>()...});
         }
 
-        FilterQuery& ForEach(std::function<void(Components&...)>&& func)
+        FilterQuery& ForEach(FunctionType&& func)
         {
             m_Function = std::move(func);
             return *this;
         }
 
+        // Binds any invocable by type, see BoundQuery.
+        template<typename Func> requires (!std::is_same_v<std::decay_t<Func>, FunctionType> && std::is_invocable_v<Func&, Components&...>)
+        BoundQuery<FilterQuery, std::decay_t<Func>> ForEach(Func&& func)
+        {
+            return BoundQuery<FilterQuery, std::decay_t<Func>>(std::move(*this), std::forward<Func>(func));
+        }
+
         void Run()
         {
-            ForEachRunImpl(std::index_sequence_for<Components...>{});
+            RunWith(m_Function);
         }
 
+        // The plan the next Run() would use, without running the query.
+        QueryPlan Explain()
+        {
+            return Plan();
+        }
+
+        // Runs the query and returns its plan with the measured cost next to the predicted one.
+        QueryPlan Analyze()
+        {
+            return AnalyzeWith(m_Function);
+        }
+
+        // Records the query as a system run by Registry::ExecuteScheduledSystems, in parallel with other
+        // systems whose component access does not conflict. Const components are only read.
         void Schedule()
         {
+            ScheduleWith(m_Function);
         }
 
         void Dispatch()
         {
-            ForEachDispatchImpl(std::index_sequence_for<Components...>{});
+            DispatchWith(m_Function);
+        }
+
+        // Calls func(Span<Components>...) with blocks of up to ChunkSize matching entities, the spans line up
+        // element by element. Archetype chunks and owning groups of exactly these components hand out slices
+        // of their packed arrays, otherwise the components are gathered into scratch blocks and the mutable
+        // ones are written back after each call.
+        template<size_t ChunkSize = QUERY_CHUNK_SIZE, typename Func>
+        void ForEachChunk(Func&& func)
+        {
+            ForEachChunkImpl<ChunkSize>(func, std::index_sequence_for<Components...>{});
+        }
+
+        class Iterator
+        {
+        public:
+            Iterator(FilterQuery* query, ComponentMaskAVX::Iterator it)
+                : m_Query(query), m_It(it)
+            {
+            }
+
+            std::tuple<Components&...> operator*() const
+            {
+                return m_Query->Row(*m_It, std::index_sequence_for<Components...>{});
+            }
+
+            Iterator& operator++()
+            {
+                ++m_It;
+                return *this;
+            }
+
+            bool operator==(const Iterator& other) const { return m_It == other.m_It; }
+            bool operator!=(const Iterator& other) const { return m_It != other.m_It; }
+
+        private:
+            FilterQuery* m_Query;
+            ComponentMaskAVX::Iterator m_It;
+        };
+
+        // Range-for over the matching entities, e.g. for (auto [pos, vel] : registry.Filter<Position, Velocity>())
+        Iterator begin()
+        {
+            m_JointMask = m_Storages[0]->Mask();
+            for (size_t i = 1; i < sizeof...(Components); ++i)
+            {
+                m_JointMask &= m_Storages[i]->Mask();
+            }
+
+            ResolveStorages(std::index_sequence_for<Components...>{});
+            return Iterator(this, m_JointMask.begin());
+        }
+
+        Iterator end()
+        {
+            return Iterator(this, m_JointMask.end());
         }
 
     private:
+        template<typename, typename>
+        friend class BoundQuery;
+
+        template<typename Func>
+        void RunWith(Func& func)
+        {
+            ForEachRunImpl(Plan(), func, std::index_sequence_for<Components...>{});
+        }
+
+        template<typename Func>
+        void ScheduleWith(const Func& func)
+        {
+            SystemEntry entry;
+            FillSystemAccess<Components...>(entry);
+
+            entry.Task = [query = *this, func]() mutable
+            {
+                query.RunWith(func);
+            };
+
+            m_Scheduler->Register(std::move(entry));
+        }
+
+        template<typename Func>
+        void DispatchWith(Func& func)
+        {
+            ForEachDispatchImpl(func, std::index_sequence_for<Components...>{});
+        }
+
+        template<typename Func>
+        QueryPlan AnalyzeWith(Func& func)
+        {
+            using Clock = std::chrono::high_resolution_clock;
+
+            QueryPlan plan = Plan();
+
+            auto t0 = Clock::now();
+            plan.ActualMatches = ForEachRunImpl(plan, func, std::index_sequence_for<Components...>{});
+            auto t1 = Clock::now();
+
+            plan.ActualNs = std::chrono::duration<double, std::nano>(t1 - t0).count();
+            return plan;
+        }
+
+        template<size_t... Indices>
+        void ResolveStorages(std::index_sequence<Indices...>)
+        {
+            m_Refs = { StorageRef<std::remove_const_t<Components>>(m_Storages[Indices])... };
+        }
+
         template<size_t... Indices>
-        void ForEachRunImpl(std::index_sequence<Indices...>)
+        std::tuple<Components&...> Row(Entity e, std::index_sequence<Indices...>)
+        {
+            return std::tuple<Components&...>((Components&)std::get<Indices>(m_Refs).Get(e)...);
+        }
+
+        QueryPlan Plan()
         {
-            constexpr size_t Arity = sizeof...(Components);
+            return PlanQuery(m_Storages, Span<IComponentStorage*>(), m_EntityCount->load(std::memory_order_relaxed));
+        }
 
-            // Find min count
-            std::array<size_t, Arity> counts = { m_Storages[Indices]->Indices().Size()... };
-            size_t minCount = counts[0];
-            size_t minIdx = 0;
-            for (size_t i = 1; i < Arity; ++i)
+        // Returns the number of matched entities.
+        template<typename Func, size_t... Indices>
+        size_t ForEachRunImpl(const QueryPlan& plan, Func& func, std::index_sequence<Indices...>)
+        {
+            if (plan.Strategy == QueryStrategy::Chunks)
             {
-                if (counts[i] < minCount)
+                // All components live in archetypes, walk the matching chunks column by column
+                return ForEachChunkRunImpl(func, std::index_sequence<Indices...>{});
+            }
+
+            bool addressable = AllAddressable<sizeof...(Components)>(&m_Storages[0]);
+
+            if (plan.Strategy == QueryStrategy::MaskAnd || !addressable)
+            {
+                // Compute joint mask by ANDing all masks once
+                m_JointMask = m_Storages[0]->Mask();
+                for (size_t i = 1; i < sizeof...(Components); ++i)
                 {
-                    minCount = counts[i];
-                    minIdx = i;
+                    m_JointMask &= m_Storages[i]->Mask();
                 }
             }
 
-            bool lowEntiyCount = (m_EntityCount <= 1000);
-            bool mediumEntiyCountLowDensity = (m_EntityCount > 1000 && m_EntityCount <= 10000 && minCount <= 1500);
-            bool mediumHightEntiyCountLowDensity = (m_EntityCount > 10000 && m_EntityCount <= 20000 && minCount <= 3000);
+            if (!addressable)
+            {
+                // SoA components only exist as copies
+                return RunGathered<QUERY_CHUNK_SIZE, Components...>(&m_Storages[0], m_JointMask, func);
+            }
 
-            if (lowEntiyCount || mediumEntiyCountLowDensity || mediumHightEntiyCountLowDensity)// || hightEntiyCountLowDensity)   /// <<< low‐density branch
+            size_t matches = 0;
+
+            // Resolve the concrete storages once, the loops below are instantiated per storage kind
+            WithTypedStorages<std::remove_const_t<Components>...>(&m_Storages[0], [&](const auto&... storages)
             {
-                for (Entity e : m_Storages[minIdx]->Indices())
+                switch (plan.Strategy)
                 {
-                    // test each other array via Has()
-                    bool ok = (m_Storages[Indices]->Has(e) && ...);
-                    if (!ok) continue;
+                case QueryStrategy::Probe:
+                    for (Entity e : m_Storages[plan.DrivingStorage]->Indices())
+                    {
+                        // test each other array via Has()
+                        bool ok = (storages.Has(e) && ...);
+                        if (!ok) continue;
+
+                        // unpack components in index order
+                        func((Components&)storages.Get(e)...);
+                        matches++;
+                    }
+                    break;
+                default:
+                    for (Entity e : m_JointMask)
+                    {
+                        func((Components&)storages.Get(e)...);
+                        matches++;
+                    }
+                    break;
+                }
+            });
+
+            return matches;
+        }
+
+        template<typename Func, size_t... Indices>
+        size_t ForEachChunkRunImpl(Func& func, std::index_sequence<Indices...>)
+        {
+            size_t matches = 0;
+
+            using First = std::remove_const_t<std::tuple_element_t<0, std::tuple<Components...>>>;
+            ArchetypeStorage& archetypes = ((ArchetypeComponentStorage<First>*)m_Storages[0])->Archetypes();
+
+            ArchetypeSignature signature;
+            (signature.set(ComponentTypeID::Get<std::remove_const_t<Components>>()), ...);
+
+            archetypes.ForEachChunk(signature, [&](const Archetype& archetype, uint32_t chunk, uint32_t count)
+            {
+                std::tuple<Components*...> columns = { (Components*)archetype.Column(chunk, ComponentTypeID::Get<std::remove_const_t<Components>>())... };
 
-                    // unpack components in index order
-                    m_Function((Components&)*((Components*)(m_Storages[Indices]->Get(e)))...);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    func(std::get<Indices>(columns)[i]...);
                 }
+
+                matches += count;
+            });
+
+            return matches;
+        }
+
+        template<size_t ChunkSize, typename Func, size_t... Indices>
+        void ForEachChunkImpl(Func& func, std::index_sequence<Indices...>)
+        {
+            if ((... && (m_Storages[Indices]->Kind() == StorageKind::Archetype)))
+            {
+                using First = std::remove_const_t<std::tuple_element_t<0, std::tuple<Components...>>>;
+                ArchetypeStorage& archetypes = ((ArchetypeComponentStorage<First>*)m_Storages[0])->Archetypes();
+
+                ArchetypeSignature signature;
+                (signature.set(ComponentTypeID::Get<std::remove_const_t<Components>>()), ...);
+
+                archetypes.ForEachChunk(signature, [&](const Archetype& archetype, uint32_t chunk, uint32_t count)
+                {
+                    std::tuple<Components*...> columns = { (Components*)archetype.Column(chunk, ComponentTypeID::Get<std::remove_const_t<Components>>())... };
+
+                    for (size_t first = 0; first < count; first += ChunkSize)
+                    {
+                        size_t n = std::min<size_t>(ChunkSize, count - first);
+                        func(Span<Components>(std::get<Indices>(columns) + first, n)...);
+                    }
+                });
+                return;
             }
-            else
+
+            if (OwningGroup<Components...>* group = OwningGroupOf(std::index_sequence<Indices...>{}))
             {
-                // Compute joint mask by ANDing all masks once
-                m_JointMask = m_Storages[0]->Mask();
-                for (size_t i = 1; i < sizeof...(Components); ++i)
+                std::tuple<Components*...> arrays = { (Components*)((SparseComponentStorage<std::remove_const_t<Components>>*)m_Storages[Indices])->Data()... };
+
+                for (size_t first = 0, count = group->Size(); first < count; first += ChunkSize)
                 {
-                    m_JointMask &= m_Storages[i]->Mask();
+                    size_t n = std::min<size_t>(ChunkSize, count - first);
+                    func(Span<Components>(std::get<Indices>(arrays) + first, n)...);
                 }
+                return;
+            }
+
+            m_JointMask = m_Storages[0]->Mask();
+            for (size_t i = 1; i < sizeof...(Components); ++i)
+            {
+                m_JointMask &= m_Storages[i]->Mask();
+            }
+
+            std::tuple<std::vector<std::remove_const_t<Components>>...> scratch = { std::vector<std::remove_const_t<Components>>(ChunkSize)... };
+            std::array<Entity, ChunkSize> entities;
+            size_t n = 0;
+
+            // Gathered and written back one column at a time, each column resolves its storage once per block
+            auto flush = [&]()
+            {
+                (GatherComponents(m_Storages[Indices], entities.data(), n, std::get<Indices>(scratch).data()), ...);
+                func(Span<Components>(std::get<Indices>(scratch).data(), n)...);
+                (ScatterComponents<Components>(m_Storages[Indices], entities.data(), n, std::get<Indices>(scratch).data()), ...);
+                n = 0;
+            };
 
-                for (Entity e : m_JointMask)
+            for (Entity e : m_JointMask)
+            {
+                entities[n] = e;
+
+                if (++n == ChunkSize)
                 {
-                    m_Function((Components&)*((Components*)(m_Storages[Indices]->Get(e)))...);
+                    flush();
                 }
             }
+
+            if (n)
+            {
+                flush();
+            }
         }
 
+        // The owning group of exactly these components, if every storage is owned by it.
         template<size_t... Indices>
-        void ForEachDispatchImpl(std::index_sequence<Indices...>)
+        OwningGroup<Components...>* OwningGroupOf(std::index_sequence<Indices...>)
+        {
+            if (!(... && (m_Storages[Indices]->Kind() == StorageKind::Sparse)))
+            {
+                return nullptr;
+            }
+
+            using First = std::remove_const_t<std::tuple_element_t<0, std::tuple<Components...>>>;
+
+            // Storages owned by another group (or none) cannot share this group's TypeID
+            IGroupHandler* group = ((SparseComponentStorage<First>*)m_Storages[0])->Group();
+            if (!group || group->TypeID() != OwningGroup<Components...>::StaticTypeID())
+            {
+                return nullptr;
+            }
+
+            return (OwningGroup<Components...>*)group;
+        }
+
+        template<typename Func, size_t... Indices>
+        void ForEachDispatchImpl(Func& func, std::index_sequence<Indices...>)
         {
+            HBL2_CORE_ASSERT(AllAddressable<sizeof...(Components)>(&m_Storages[0]), "SoA components can not be dispatched, use Run or ForEachChunk!");
+
             // Compute joint mask by ANDing all masks once
             m_JointMask = m_Storages[0]->Mask();
             for (size_t i = 1; i < sizeof...(Components); ++i)
@@ -113,7 +390,7 @@ namespace HBL2
                 m_JointMask,
                 m_Storages,
                 std::max(32u, entityCount / (JobSystem::Get().GetThreadCount() * 4)), // Dynamic group size
-                m_Function,
+                func,
                 std::make_index_sequence<sizeof...(Components)>{}
             );
 
@@ -127,16 +404,18 @@ namespace HBL2
             uint8_t id = ComponentTypeID::Get<T>();
             if (!m_AllStorages[id])
             {
-                m_AllStorages[id] = (IComponentStorage*)new SparseComponentStorage<T>();
+                m_AllStorages[id] = (IComponentStorage*)new DefaultComponentStorage<T>();
             }
             return m_AllStorages[id];
         }
 
     private:
         StaticArray<IComponentStorage*, sizeof...(Components)> m_Storages;
+        std::tuple<StorageRef<std::remove_const_t<Components>>...> m_Refs;
         Span<IComponentStorage*> m_AllStorages;
+        Scheduler* m_Scheduler = nullptr;
         ComponentMaskAVX m_JointMask;
-        std::function<void(Components&...)> m_Function;
-        uint32_t m_EntityCount = 0;
+        FunctionType m_Function;
+        const std::atomic<uint32_t>* m_EntityCount = nullptr;
     };
 }
\ No newline at end of file
@@ -4,8 +4,33 @@
 #include "Utilities/Collections/Span.h"
 #include "Utilities/Collections/TrampolineFunction.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace HBL2
 {
+    enum class StorageKind : uint8_t
+    {
+        Sparse,
+        SparsePaged,
+        Small,
+        Singleton,
+        Archetype,
+        SoA,
+        Tag,
+    };
+
+    // Notified by a storage after a component was added or removed, and after the storage was cleared.
+    class IStorageObserver
+    {
+    public:
+        virtual ~IStorageObserver() = default;
+
+        virtual void OnAdd(Entity e) = 0;
+        virtual void OnRemove(Entity e) = 0;
+        virtual void OnClear() = 0;
+    };
+
     class IComponentStorage
     {
     public:
@@ -18,9 +43,63 @@ namespace HBL2
 
         virtual ComponentMaskAVX& Mask() const = 0;
         virtual const Span<const Entity> Indices() const = 0;
+        virtual StorageKind Kind() const = 0;
 
         virtual void Clear() = 0;
 
+        // Removes the component from every entity of the span that has it. The default removes one
+        // entity at a time, storages override it with a batched path.
+        virtual void RemoveRange(Span<const Entity> entities)
+        {
+            for (Entity e : entities)
+            {
+                if (Has(e))
+                {
+                    Remove(e);
+                }
+            }
+        }
+
         virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const = 0;
+
+        void AddObserver(IStorageObserver* observer)
+        {
+            m_Observers.push_back(observer);
+        }
+
+        void RemoveObserver(IStorageObserver* observer)
+        {
+            m_Observers.erase(std::remove(m_Observers.begin(), m_Observers.end(), observer), m_Observers.end());
+        }
+
+        bool HasObservers() const { return !m_Observers.empty(); }
+
+    protected:
+        void NotifyAdd(Entity e)
+        {
+            for (IStorageObserver* observer : m_Observers)
+            {
+                observer->OnAdd(e);
+            }
+        }
+
+        void NotifyRemove(Entity e)
+        {
+            for (IStorageObserver* observer : m_Observers)
+            {
+                observer->OnRemove(e);
+            }
+        }
+
+        void NotifyClear()
+        {
+            for (IStorageObserver* observer : m_Observers)
+            {
+                observer->OnClear();
+            }
+        }
+
+    private:
+        std::vector<IStorageObserver*> m_Observers;
     };
 }
\ No newline at end of file
@@ -53,6 +53,7 @@ namespace HBL2
         {
             const char* name;
             std::size_t offset;
+            std::size_t size;
             TypeID type;
 
             // read
@@ -210,6 +211,7 @@ namespace HBL2
                 MemberData md; 
                 md.name = name;
                 md.offset = reinterpret_cast<std::size_t>(&(reinterpret_cast<T*>(0)->*MemberPtr));
+                md.size = sizeof(MemberT);
                 md.type = TypeIndex<MemberT>::value;
                 td.members.push_back(md);
                 return *this;
@@ -234,7 +236,7 @@ namespace HBL2
             return a;
         }
 
-        void Reset(Context& ctx)
+        inline void Reset(Context& ctx)
         {
             ctx.types.clear();
         }
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "SparseComponentStorage.h"
+
+#include <tuple>
+
+namespace HBL2
+{
+    // Owns the sparse storages of its components and keeps every entity that has all of them
+    // packed at the front of each packed array, in the same order. Iteration is a linear walk
+    // over the first Size() elements of each array, no mask or sparse lookups involved.
+    template<typename... Components>
+    class OwningGroup final : public IGroupHandler
+    {
+        static_assert(sizeof...(Components) > 1, "An owning group needs at least two components!");
+
+    public:
+        OwningGroup(SparseComponentStorage<std::remove_const_t<Components>>*... storages)
+            : m_Storages(storages...)
+        {
+            std::apply([this](auto*... storage) { (storage->SetGroup(this), ...); }, m_Storages);
+
+            // Pull in the entities that already match, driving from the smallest storage.
+            Span<const Entity> smallest = std::get<0>(m_Storages)->Indices();
+            std::apply([&](auto*... storage)
+            {
+                ((storage->Indices().Size() < smallest.Size() ? (void)(smallest = storage->Indices()) : (void)0), ...);
+            }, m_Storages);
+
+            std::vector<Entity> candidates(smallest.begin(), smallest.end());
+            for (Entity e : candidates)
+            {
+                OnAdd(e);
+            }
+        }
+
+        ~OwningGroup()
+        {
+            std::apply([](auto*... storage) { (storage->SetGroup(nullptr), ...); }, m_Storages);
+        }
+
+        virtual void OnAdd(Entity e) override
+        {
+            if (!HasAll(e) || Contains(e))
+            {
+                return;
+            }
+
+            std::apply([&](auto*... storage) { (storage->Swap(storage->Index(e), m_Size), ...); }, m_Storages);
+            m_Size++;
+        }
+
+        virtual void OnRemove(Entity e) override
+        {
+            if (!HasAll(e) || !Contains(e))
+            {
+                return;
+            }
+
+            m_Size--;
+            std::apply([&](auto*... storage) { (storage->Swap(storage->Index(e), m_Size), ...); }, m_Storages);
+        }
+
+        virtual void OnClear() override
+        {
+            m_Size = 0;
+        }
+
+        virtual size_t TypeID() const override
+        {
+            return StaticTypeID();
+        }
+
+        static size_t StaticTypeID()
+        {
+            static const char tag = 0;
+            return reinterpret_cast<size_t>(&tag);
+        }
+
+        OwningGroup& ForEach(std::function<void(Components&...)>&& func)
+        {
+            m_Function = std::move(func);
+            return *this;
+        }
+
+        void Run()
+        {
+            RunImpl(std::index_sequence_for<Components...>{});
+        }
+
+        uint32_t Size() const { return m_Size; }
+
+        // Entities of the group, in iteration order.
+        const Span<const Entity> Entities() const
+        {
+            return { std::get<0>(m_Storages)->Indices().Data(), m_Size };
+        }
+
+    private:
+        template<size_t... Indices>
+        void RunImpl(std::index_sequence<Indices...>)
+        {
+            std::tuple<Components*...> arrays = { (Components*)std::get<Indices>(m_Storages)->Data()... };
+
+            for (uint32_t i = 0; i < m_Size; ++i)
+            {
+                m_Function(std::get<Indices>(arrays)[i]...);
+            }
+        }
+
+        bool HasAll(Entity e)
+        {
+            return std::apply([e](auto*... storage) { return (storage->Has(e) && ...); }, m_Storages);
+        }
+
+        bool Contains(Entity e)
+        {
+            return std::get<0>(m_Storages)->Index(e) < m_Size;
+        }
+
+    private:
+        std::tuple<SparseComponentStorage<std::remove_const_t<Components>>*...> m_Storages;
+        std::function<void(Components&...)> m_Function;
+        uint32_t m_Size = 0;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace HBL2
+{
+    // Packed array split in fixed size blocks indexed through a block table.
+    // Growing never moves existing elements, so pointers stay valid across push_back.
+    // Blocks are kept after shrinking and reused as a pool, so churn does not hit the allocator.
+    template<typename T, size_t BlockSize = 1024>
+    class PagedArray
+    {
+        static_assert((BlockSize & (BlockSize - 1)) == 0, "PagedArray block size must be a power of two!");
+
+    public:
+        static constexpr size_t BLOCK_SIZE = BlockSize;
+        static constexpr size_t BLOCK_MASK = BlockSize - 1;
+        static constexpr size_t BLOCK_SHIFT = std::countr_zero(BlockSize);
+
+        PagedArray() = default;
+        PagedArray(const PagedArray&) = delete;
+        PagedArray& operator=(const PagedArray&) = delete;
+
+        ~PagedArray()
+        {
+            clear();
+
+            for (T* block : m_Blocks)
+            {
+                ::operator delete(block, std::align_val_t(alignof(T) > 32 ? alignof(T) : 32));
+            }
+        }
+
+        size_t size() const { return m_Size; }
+        bool empty() const { return m_Size == 0; }
+
+        T& operator[](size_t i) { return m_Blocks[i >> BLOCK_SHIFT][i & BLOCK_MASK]; }
+        const T& operator[](size_t i) const { return m_Blocks[i >> BLOCK_SHIFT][i & BLOCK_MASK]; }
+
+        T& back() { return (*this)[m_Size - 1]; }
+
+        // Contiguous elements of a block and their count.
+        T* block(size_t b) const { return m_Blocks[b]; }
+        size_t block_count() const { return (m_Size + BLOCK_MASK) >> BLOCK_SHIFT; }
+        size_t block_size(size_t b) const { return (m_Size - (b << BLOCK_SHIFT) < BLOCK_SIZE) ? (m_Size - (b << BLOCK_SHIFT)) : BLOCK_SIZE; }
+
+        template<typename... Args>
+        T& emplace_back(Args&&... args)
+        {
+            if ((m_Size >> BLOCK_SHIFT) >= m_Blocks.size())
+            {
+                m_Blocks.push_back((T*)::operator new(sizeof(T) * BLOCK_SIZE, std::align_val_t(alignof(T) > 32 ? alignof(T) : 32)));
+            }
+
+            T* ptr = &m_Blocks[m_Size >> BLOCK_SHIFT][m_Size & BLOCK_MASK];
+            new(ptr) T(std::forward<Args>(args)...);
+            m_Size++;
+            return *ptr;
+        }
+
+        void push_back(const T& value) { emplace_back(value); }
+        void push_back(T&& value) { emplace_back(std::move(value)); }
+
+        void pop_back()
+        {
+            back().~T();
+            m_Size--;
+        }
+
+        void clear()
+        {
+            while (m_Size > 0)
+            {
+                pop_back();
+            }
+        }
+
+    private:
+        std::vector<T*> m_Blocks;
+        size_t m_Size = 0;
+    };
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "IComponentStorage.h"
+#include "TagComponentStorage.h"
+#include "TypedStorage.h"
+
+#include <tuple>
+
+namespace HBL2
+{
+    // A query registered once with Registry::PersistentFilter. It observes the storages of its
+    // components and keeps its joint mask (and optionally a dense entity list) up to date on every
+    // Add/Remove, so running it costs nothing per frame beyond the matched entities themselves.
+    template<typename... Components>
+    class PersistentQuery final : public IStorageObserver
+    {
+    public:
+        PersistentQuery(StaticArray<IComponentStorage*, sizeof...(Components)> storages, bool trackEntities)
+            : m_Storages(storages)
+        {
+            // One full AND at registration, incremental from then on
+            m_JointMask = m_Storages[0]->Mask();
+            for (size_t i = 1; i < sizeof...(Components); ++i)
+            {
+                m_JointMask &= m_Storages[i]->Mask();
+            }
+
+            if (trackEntities)
+            {
+                TrackEntities();
+            }
+
+            for (size_t i = 0; i < sizeof...(Components); ++i)
+            {
+                m_Storages[i]->AddObserver(this);
+            }
+        }
+
+        ~PersistentQuery()
+        {
+            for (size_t i = 0; i < sizeof...(Components); ++i)
+            {
+                m_Storages[i]->RemoveObserver(this);
+            }
+        }
+
+        virtual void OnAdd(Entity e) override
+        {
+            if (m_JointMask.test(e) || !HasAll(e))
+            {
+                return;
+            }
+
+            m_JointMask.set(e);
+
+            if (m_TrackEntities)
+            {
+                if (EntityIndex(e) >= m_Positions.size())
+                {
+                    m_Positions.resize(EntityIndex(e) + 1, UINT32_MAX);
+                }
+
+                m_Positions[EntityIndex(e)] = (uint32_t)m_Entities.size();
+                m_Entities.push_back(EntityIndex(e));
+            }
+        }
+
+        virtual void OnRemove(Entity e) override
+        {
+            if (!m_JointMask.test(e))
+            {
+                return;
+            }
+
+            m_JointMask.reset(e);
+
+            if (m_TrackEntities)
+            {
+                uint32_t pos = m_Positions[EntityIndex(e)];
+                Entity lastEntity = m_Entities.back();
+                m_Entities[pos] = lastEntity;
+                m_Positions[lastEntity] = pos;
+                m_Entities.pop_back();
+                m_Positions[EntityIndex(e)] = UINT32_MAX;
+            }
+        }
+
+        virtual void OnClear() override
+        {
+            m_JointMask.clear();
+
+            for (Entity e : m_Entities)
+            {
+                m_Positions[e] = UINT32_MAX;
+            }
+            m_Entities.clear();
+        }
+
+        // Additionally maintain a dense list of the matching entities, iterated instead of the mask.
+        void TrackEntities()
+        {
+            if (m_TrackEntities)
+            {
+                return;
+            }
+
+            m_TrackEntities = true;
+            for (Entity e : m_JointMask)
+            {
+                if (e >= m_Positions.size())
+                {
+                    m_Positions.resize(e + 1, UINT32_MAX);
+                }
+
+                m_Positions[e] = (uint32_t)m_Entities.size();
+                m_Entities.push_back(e);
+            }
+        }
+
+        PersistentQuery& ForEach(std::function<void(Components&...)>&& func)
+        {
+            m_Function = std::move(func);
+            return *this;
+        }
+
+        void Run()
+        {
+            ForEachRunImpl(std::index_sequence_for<Components...>{});
+        }
+
+        void Dispatch()
+        {
+            ForEachDispatchImpl(std::index_sequence_for<Components...>{});
+        }
+
+        const ComponentMaskAVX& Mask() const { return m_JointMask; }
+
+        // Indices of the matching entities in no particular order, empty unless TrackEntities() was requested.
+        const Span<const Entity> Entities() const { return m_Entities; }
+
+        static size_t StaticTypeID()
+        {
+            static const char tag = 0;
+            return reinterpret_cast<size_t>(&tag);
+        }
+
+    private:
+        template<size_t... Indices>
+        void ForEachRunImpl(std::index_sequence<Indices...>)
+        {
+            if (!AllAddressable<sizeof...(Components)>(&m_Storages[0]))
+            {
+                // SoA components only exist as copies
+                RunGathered<QUERY_CHUNK_SIZE, Components...>(&m_Storages[0], m_JointMask, m_Function);
+                return;
+            }
+
+            if (m_TrackEntities)
+            {
+                for (Entity e : m_Entities)
+                {
+                    m_Function(Fetch<Indices>(e)...);
+                }
+            }
+            else
+            {
+                for (Entity e : m_JointMask)
+                {
+                    m_Function(Fetch<Indices>(e)...);
+                }
+            }
+        }
+
+        template<size_t... Indices>
+        void ForEachDispatchImpl(std::index_sequence<Indices...>)
+        {
+            HBL2_CORE_ASSERT(AllAddressable<sizeof...(Components)>(&m_Storages[0]), "SoA components can not be dispatched, use Run!");
+
+            uint32_t entityCount = m_TrackEntities ? (uint32_t)m_Entities.size() : (uint32_t)m_JointMask.count();
+
+            JobContext ctx;
+
+            // Use the specialized ECS dispatch
+            JobSystem::Get().DispatchQuery<Components...>(
+                ctx,
+                m_JointMask,
+                m_Storages,
+                std::max(32u, entityCount / (JobSystem::Get().GetThreadCount() * 4)), // Dynamic group size
+                m_Function,
+                std::make_index_sequence<sizeof...(Components)>{}
+            );
+
+            // Wait for completion
+            JobSystem::Get().Wait(ctx);
+        }
+
+        // Tags carry no per-entity data, so they are served without touching their storage.
+        template<size_t Index>
+        decltype(auto) Fetch(Entity e)
+        {
+            using C = std::tuple_element_t<Index, std::tuple<Components...>>;
+
+            if constexpr (IsTagComponent<std::remove_const_t<C>>)
+            {
+                return (C&)((TagComponentStorage<std::remove_const_t<C>>*)m_Storages[Index])->Value();
+            }
+            else
+            {
+                return (C&)*((C*)(m_Storages[Index]->Get(e)));
+            }
+        }
+
+        bool HasAll(Entity e)
+        {
+            for (size_t i = 0; i < sizeof...(Components); ++i)
+            {
+                if (!m_Storages[i]->Has(e))
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+    private:
+        StaticArray<IComponentStorage*, sizeof...(Components)> m_Storages;
+        ComponentMaskAVX m_JointMask;
+        std::vector<Entity> m_Entities;
+        std::vector<uint32_t> m_Positions;
+        std::function<void(Components&...)> m_Function;
+        bool m_TrackEntities = false;
+    };
+}
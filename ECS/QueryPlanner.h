@@ -0,0 +1,209 @@
+#pragma once
+
+#include "IComponentStorage.h"
+#include "SparseComponentStorage.h"
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+namespace HBL2
+{
+    enum class QueryStrategy : uint8_t
+    {
+        Probe,      // Walk the smallest storage, Has() on the others
+        MaskAnd,    // AND the masks, walk the joint mask
+        Chunks,     // Every component is archetype-backed, walk matching chunks
+    };
+
+    // Per-operation costs in nanoseconds. The defaults are a typical desktop x64 machine,
+    // QueryCostModel::Calibrate() replaces them with values measured on the running machine.
+    struct QueryCostModel
+    {
+        double ProbeNs = 2.0;       // One Has() on a storage
+        double WordNs = 0.6;        // Copy or AND of one occupied mask word
+        double VisitNs = 1.5;       // Stepping to the next entity of an index list or mask
+        double FetchNs = 2.0;       // One Get() for a matched entity, paid equally by every strategy
+
+        static QueryCostModel& Get()
+        {
+            static QueryCostModel s_Model;
+            return s_Model;
+        }
+
+        // Times each operation on a synthetic sparse storage pair and stores the result in Get().
+        // Meant to be called once at startup, it takes a few milliseconds.
+        static void Calibrate(uint32_t entityCount = 1 << 16)
+        {
+            using Clock = std::chrono::high_resolution_clock;
+
+            SparseComponentStorage<uint32_t> a, b;
+            for (Entity e = 0; e < entityCount; ++e)
+            {
+                a.Add(e);
+                if (e % 3 != 0)
+                {
+                    b.Add(e);
+                }
+            }
+
+            // Queries resolve sparse storages to their concrete type, so probe and fetch through it as well
+            IComponentStorage* sa = (IComponentStorage*)&a;
+            IComponentStorage* sb = (IComponentStorage*)&b;
+
+            // Probes and list visits
+            size_t hits = 0;
+            auto t0 = Clock::now();
+            for (Entity e : sa->Indices())
+            {
+                hits += b.Has(e);
+            }
+            auto t1 = Clock::now();
+            for (Entity e : sa->Indices())
+            {
+                hits += e & 1;
+            }
+            auto t2 = Clock::now();
+
+            // Mask words and mask visits
+            ComponentMaskAVX joint = sa->Mask();
+            joint &= sb->Mask();
+            auto t3 = Clock::now();
+            for (int i = 0; i < 4; ++i)
+            {
+                joint = sa->Mask();
+                joint &= sb->Mask();
+            }
+            auto t4 = Clock::now();
+            for (Entity e : joint)
+            {
+                hits += e & 1;
+            }
+            auto t5 = Clock::now();
+            for (Entity e : sa->Indices())
+            {
+                hits += *(uint32_t*)a.Get(e);
+            }
+            auto t6 = Clock::now();
+
+            auto ns = [](Clock::time_point from, Clock::time_point to)
+            {
+                return std::chrono::duration<double, std::nano>(to - from).count();
+            };
+
+            double visit = ns(t1, t2) / entityCount;
+            double words = 4.0 * 2.0 * (double)sa->Mask().occupied_words();
+
+            QueryCostModel& model = Get();
+            model.VisitNs = std::max(0.05, std::max(visit, ns(t4, t5) / std::max<size_t>(1, joint.count())));
+            model.ProbeNs = std::max(0.05, ns(t0, t1) / entityCount - visit);
+            model.WordNs = std::max(0.05, ns(t3, t4) / words);
+            model.FetchNs = std::max(0.05, ns(t5, t6) / entityCount - visit);
+
+            // Keep the work observable so the timed loops are not optimized away
+            volatile size_t sink = hits;
+            (void)sink;
+        }
+    };
+
+    // The plan chosen for one run of a query, see FilterQuery::Explain and FilterQuery::Analyze.
+    struct QueryPlan
+    {
+        QueryStrategy Strategy = QueryStrategy::MaskAnd;
+        uint32_t DrivingStorage = 0;    // Include index walked by the probe strategy
+        size_t DrivingCount = 0;
+        size_t MaskWords = 0;           // Occupied mask words touched by the mask strategy
+        size_t EstimatedMatches = 0;
+        double ProbeCostNs = 0.0;
+        double MaskCostNs = 0.0;
+        double PredictedNs = 0.0;
+        double ActualNs = -1.0;         // Filled in by Analyze(), negative if the query was not run
+        size_t ActualMatches = 0;
+
+        void Print(std::ostream& out) const
+        {
+            static const char* names[] = { "Probe", "MaskAnd", "Chunks" };
+
+            std::ios_base::fmtflags flags = out.flags();
+            std::streamsize precision = out.precision();
+            out << std::fixed << std::setprecision(0);
+
+            out << "QueryPlan: " << names[(int)Strategy] << " (driving storage " << DrivingStorage << ", " << DrivingCount << " entities, " << MaskWords << " mask words)\n";
+            out << "    probe cost " << ProbeCostNs << " ns, mask cost " << MaskCostNs << " ns, estimated matches " << EstimatedMatches << "\n";
+            if (ActualNs >= 0.0)
+            {
+                out << "    predicted " << PredictedNs << " ns, actual " << ActualNs << " ns, " << ActualMatches << " matches\n";
+            }
+            else
+            {
+                out << "    predicted " << PredictedNs << " ns\n";
+            }
+
+            out.flags(flags);
+            out.precision(precision);
+        }
+    };
+
+    // Estimates both strategies from storage sizes and mask occupancy and picks the cheaper one.
+    // Matches are estimated assuming the components are independently distributed over the entities.
+    inline QueryPlan PlanQuery(Span<IComponentStorage*> includes, Span<IComponentStorage*> excludes, uint32_t entityCount)
+    {
+        const QueryCostModel& model = QueryCostModel::Get();
+
+        QueryPlan plan;
+
+        bool chunks = true;
+        double selectivity = 1.0;
+        size_t minCount = SIZE_MAX;
+
+        for (size_t i = 0; i < includes.Size(); ++i)
+        {
+            IComponentStorage* storage = includes[i];
+            size_t count = storage->Indices().Size();
+
+            chunks = chunks && storage->Kind() == StorageKind::Archetype;
+            selectivity *= entityCount ? std::min(1.0, (double)count / entityCount) : 0.0;
+            plan.MaskWords += storage->Mask().occupied_words();
+
+            if (count < minCount)
+            {
+                minCount = count;
+                plan.DrivingStorage = (uint32_t)i;
+            }
+        }
+
+        for (size_t i = 0; i < excludes.Size(); ++i)
+        {
+            size_t count = excludes[i]->Indices().Size();
+            selectivity *= entityCount ? 1.0 - std::min(1.0, (double)count / entityCount) : 1.0;
+            plan.MaskWords += excludes[i]->Mask().occupied_words();
+        }
+
+        plan.DrivingCount = minCount;
+        plan.EstimatedMatches = std::min(minCount, (size_t)(selectivity * entityCount));
+
+        size_t probes = includes.Size() - 1 + excludes.Size();
+        double fetchNs = (double)plan.EstimatedMatches * model.FetchNs * includes.Size();
+
+        plan.ProbeCostNs = (double)minCount * (model.VisitNs + model.ProbeNs * probes) + fetchNs;
+        plan.MaskCostNs = (double)plan.MaskWords * model.WordNs + (double)plan.EstimatedMatches * model.VisitNs + fetchNs;
+
+        if (chunks && excludes.Size() == 0)
+        {
+            plan.Strategy = QueryStrategy::Chunks;
+            plan.PredictedNs = (double)plan.EstimatedMatches * model.VisitNs;
+        }
+        else if (plan.ProbeCostNs <= plan.MaskCostNs)
+        {
+            plan.Strategy = QueryStrategy::Probe;
+            plan.PredictedNs = plan.ProbeCostNs;
+        }
+        else
+        {
+            plan.Strategy = QueryStrategy::MaskAnd;
+            plan.PredictedNs = plan.MaskCostNs;
+        }
+
+        return plan;
+    }
+}
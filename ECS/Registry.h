@@ -3,73 +3,216 @@
 #include "EntityManager.h"
 #include "IComponentStorage.h"
 #include "SparseComponentStorage.h"
+#include "ArchetypeStorage.h"
+#include "OwningGroup.h"
+#include "SoAComponentStorage.h"
+#include "TagComponentStorage.h"
 
 #include "ViewQuery.h"
 #include "FilterQuery.h"
+#include "PersistentQuery.h"
+#include "Scheduler.h"
+#include "CommandBuffer.h"
+
+#include <unordered_map>
 
 namespace HBL2
 {
     class Registry
     {
     public:
+        Registry() = default;
+
+        explicit Registry(uint32_t entityCapacity)
+        {
+            SetEntityCapacity(entityCapacity);
+        }
+
+        // Runtime capacity policy for this world, at most MAX_ENTITIES. Storages still only grow
+        // with the highest entity index in use, this caps creation and pre-reserves bookkeeping.
+        void SetEntityCapacity(uint32_t capacity)
+        {
+            m_Entities.SetCapacity(capacity);
+        }
+
+        // Thread safe, entities can be created from jobs without a lock.
+        // Returns NO_ENTITY once the entity capacity is exhausted.
         Entity CreateEntity()
         {
-            m_EntityCount++;
-            return m_Entities.Create();
+            Entity e = m_Entities.Create();
+            if (e != NO_ENTITY)
+            {
+                m_EntityCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            return e;
+        }
+
+        // Thread safe bulk creation into out, recycled slots first, then one contiguous range of fresh indices.
+        // Returns the number of entities created, fewer than count only when the capacity is exhausted.
+        uint32_t CreateEntities(uint32_t count, Entity* out)
+        {
+            uint32_t created = m_Entities.Create(count, out);
+            m_EntityCount.fetch_add(created, std::memory_order_relaxed);
+            return created;
+        }
+
+        uint32_t CreateEntities(Span<Entity> out)
+        {
+            return CreateEntities((uint32_t)out.Size(), out.Data());
         }
+
         void DestroyEntity(Entity e)
         {
-            m_EntityCount--;
+            if (!m_Entities.IsAlive(e))
+            {
+                return;
+            }
+
+            // Only storages that exist in this registry and hold the entity
+            for (size_t i = 0; i < ComponentTypeID::GetCount(); ++i)
+            {
+                if (m_Storages[i] && m_Storages[i]->Has(e))
+                {
+                    m_Storages[i]->Remove(e);
+                }
+            }
+
+            m_EntityCount.fetch_sub(1, std::memory_order_relaxed);
             m_Entities.Destroy(e);
+        }
+
+        // Bulk DestroyEntity, stale and duplicate handles are skipped. Work is grouped by storage,
+        // each one removes the whole batch at once, in entity order.
+        void DestroyEntities(Span<const Entity> entities)
+        {
+            std::vector<Entity> alive = AliveSorted(entities);
+            if (alive.empty())
+            {
+                return;
+            }
 
             for (size_t i = 0; i < ComponentTypeID::GetCount(); ++i)
             {
-                m_Storages[i]->Remove(e);
+                if (m_Storages[i])
+                {
+                    m_Storages[i]->RemoveRange(alive);
+                }
+            }
+
+            for (Entity e : alive)
+            {
+                m_Entities.Destroy(e);
             }
+
+            m_EntityCount.fetch_sub((uint32_t)alive.size(), std::memory_order_relaxed);
         }
-        uint32_t GetEntityCount() const { return m_EntityCount; }
+        uint32_t GetEntityCount() const { return m_EntityCount.load(std::memory_order_relaxed); }
 
-        template<typename T, typename TStorage>
-        void SetStorageType()
+        // Stale handles (destroyed entities, or recycled slots with a newer generation) are rejected here,
+        // before any storage is touched, so storages only ever see live handles and key by EntityIndex.
+        bool IsAlive(Entity e) const { return m_Entities.IsAlive(e); }
+
+        template<typename T, typename TStorage, typename... Args>
+        void SetStorageType(Args&&... args)
         {
+            static_assert(!IsTagComponent<T> || std::is_same_v<TStorage, TagComponentStorage<T>>, "Tag components always use TagComponentStorage!");
+
             uint8_t id = ComponentTypeID::Get<T>();
 
-            if (m_Storages[id])
+            if (IComponentStorage* old = m_Storages[id])
             {
-                m_Storages[id]->Clear();
+                HBL2_CORE_ASSERT(!old->HasObservers(), "Storage type changed after a persistent query was created for it!");
+                HBL2_CORE_ASSERT(old->Kind() != StorageKind::Sparse || !((SparseComponentStorage<T>*)old)->Group(), "Storage type changed after an owning group was created for it!");
+                old->Clear();
+                delete old;
             }
 
-            m_Storages[id] = (IComponentStorage*)new TStorage();
+            if constexpr (std::is_constructible_v<TStorage, ArchetypeStorage&>)
+            {
+                m_Storages[id] = (IComponentStorage*)new TStorage(m_Archetypes);
+            }
+            else
+            {
+                m_Storages[id] = (IComponentStorage*)new TStorage(std::forward<Args>(args)...);
+            }
+        }
+
+        // Typed access to a storage selected with SetStorageType, e.g. for SoA column spans.
+        template<typename T, typename TStorage>
+        TStorage& GetStorage()
+        {
+            return *(TStorage*)EnsureArray<T>();
         }
 
         template<typename T>
         T& AddComponent(Entity e, T&& comp = {})
         {
+            HBL2_CORE_ASSERT(IsAlive(e), "Entity handle is stale!");
             IComponentStorage* arr = EnsureArray<T>();
             void* ptr = arr->Add(e);
             HBL2_CORE_ASSERT(ptr != nullptr, "Error while adding component!");
             return *new(ptr) T(std::forward<T>(comp));
         }
 
+        // Bulk AddComponent, values[i] goes to entities[i], none of which may have T yet.
+        // Sparse storages take the whole range at once, other storages get one Add per entity.
+        template<typename T>
+        void AddComponents(Span<const Entity> entities, Span<const T> values)
+        {
+            HBL2_CORE_ASSERT(entities.Size() == values.Size(), "Entity and component counts differ!");
+
+            for (Entity e : entities)
+            {
+                HBL2_CORE_ASSERT(IsAlive(e), "Entity handle is stale!");
+            }
+
+            IComponentStorage* storage = EnsureArray<T>();
+
+            switch (storage->Kind())
+            {
+            case StorageKind::Sparse:
+                ((SparseComponentStorage<T>*)storage)->AddRange(entities, values.Data());
+                break;
+            case StorageKind::SparsePaged:
+                ((PagedComponentStorage<T>*)storage)->AddRange(entities, values.Data());
+                break;
+            default:
+                for (size_t i = 0; i < entities.Size(); ++i)
+                {
+                    new(storage->Add(entities[i])) T(values[i]);
+                }
+                break;
+            }
+        }
+
         template<typename T, typename... Args>
         T& EmplaceComponent(Entity e, Args&&... args)
         {
+            HBL2_CORE_ASSERT(IsAlive(e), "Entity handle is stale!");
             IComponentStorage* arr = EnsureArray<T>();
             void* mem = arr->Add(e);
             HBL2_CORE_ASSERT(mem != nullptr, "Error while emplacing component!");
             return *(new(mem) T(std::forward<Args>(args)...));
         }
 
+        // SoA components have no addressable T, use GetStorage<T, SoAComponentStorage<T>>().Ref(e) for those.
         template<typename T>
         T& GetComponent(Entity e)
         {
+            HBL2_CORE_ASSERT(IsAlive(e), "Entity handle is stale!");
             IComponentStorage* arr = EnsureArray<T>();
+            HBL2_CORE_ASSERT(arr->Kind() != StorageKind::SoA, "SoA components have no addressable T, use the storage's Ref(e)!");
             return *(T*)arr->Get(e);
         }
 
         template<typename T>
         bool HasComponent(Entity e)
         {
+            if (!IsAlive(e))
+            {
+                return false;
+            }
+
             IComponentStorage* arr = EnsureArray<T>();
             return arr->Has(e);
         }
@@ -79,7 +222,7 @@ namespace HBL2
         {
             IComponentStorage* arr = EnsureArray<T>();
 
-            if (!arr->Has(e))
+            if (!IsAlive(e) || !arr->Has(e))
             {
                 return;
             }
@@ -87,20 +230,211 @@ namespace HBL2
             arr->Remove(e);
         }
 
+        // Bulk RemoveComponent, entities without T and stale handles are skipped.
+        template<typename T>
+        void RemoveComponents(Span<const Entity> entities)
+        {
+            IComponentStorage* storage = m_Storages[ComponentTypeID::Get<T>()];
+            if (!storage)
+            {
+                return;
+            }
+
+            std::vector<Entity> alive = AliveSorted(entities);
+            storage->RemoveRange(alive);
+        }
+
         template<typename Component>
         ViewQuery<Component> Filter()
         {
-            return ViewQuery<Component>(EnsureArray<std::remove_const_t<Component>>());
+            return ViewQuery<Component>(EnsureArray<std::remove_const_t<Component>>(), &m_Scheduler);
         }
 
         template<typename... Components> requires (sizeof...(Components) > 1)
         FilterQuery<Components...> Filter()
         {
-            return FilterQuery<Components...>({ m_Storages, MAX_COMPONENT_TYPES }, m_EntityCount, { EnsureArray<std::remove_const_t<Components>>()... });
+            return FilterQuery<Components...>({ m_Storages, MAX_COMPONENT_TYPES }, &m_Scheduler, &m_EntityCount, { EnsureArray<std::remove_const_t<Components>>()... });
+        }
+
+        // Reorders T's packed array by cmp (over two components or two entities), EntityOrder by default,
+        // so that queries walking the mask in entity order or by a user key touch memory sequentially.
+        template<typename T, typename Compare = EntityOrder>
+        void Sort(Compare cmp = {})
+        {
+            WithSortableStorage<T>([&](auto* storage) { storage->Sort(cmp); });
+        }
+
+        // Reorders T's packed array to follow the packed order of U.
+        template<typename T, typename U>
+        void Respect()
+        {
+            WithSortableStorage<T>([&](auto* storage) { storage->Respect(EnsureArray<U>()->Indices()); });
+        }
+
+        // Amortized Sort<T>, see SparseComponentStorage::SortIncremental. Returns true once sorted.
+        template<typename T, typename Compare = EntityOrder>
+        bool SortIncremental(size_t budget, Compare cmp = {})
+        {
+            bool sorted = false;
+            WithSortableStorage<T>([&](auto* storage) { sorted = storage->SortIncremental(cmp, budget); });
+            return sorted;
+        }
+
+        // Returns the owning group for the given components, creating it on first use.
+        // Owned components must use sparse storage and can be owned by a single group.
+        template<typename... Components> requires (sizeof...(Components) > 1)
+        OwningGroup<Components...>& Group()
+        {
+            HBL2_CORE_ASSERT(((EnsureArray<std::remove_const_t<Components>>()->Kind() == StorageKind::Sparse) && ...), "Owning groups require sparse component storage!");
+
+            IGroupHandler* owners[] = { ((SparseComponentStorage<std::remove_const_t<Components>>*)EnsureArray<std::remove_const_t<Components>>())->Group()... };
+            IGroupHandler* owner = owners[0];
+            for (IGroupHandler* group : owners)
+            {
+                HBL2_CORE_ASSERT(group == owner, "Component is already owned by another group!");
+            }
+
+            if (owner)
+            {
+                HBL2_CORE_ASSERT(owner->TypeID() == OwningGroup<Components...>::StaticTypeID(), "Component is already owned by another group!");
+                return *(OwningGroup<Components...>*)owner;
+            }
+
+            auto* group = new OwningGroup<Components...>((SparseComponentStorage<std::remove_const_t<Components>>*)EnsureArray<std::remove_const_t<Components>>()...);
+            m_Groups.push_back(group);
+            return *group;
+        }
+
+        // Returns the persistent query for the given components, creating it on first use.
+        // Its mask is maintained on every Add/Remove instead of being rebuilt per run, which pays off
+        // for queries that run every frame. Configure storage types before creating persistent queries.
+        template<typename... Components> requires (sizeof...(Components) > 1)
+        PersistentQuery<Components...>& PersistentFilter(bool trackEntities = false)
+        {
+            auto it = m_PersistentQueries.find(PersistentQuery<Components...>::StaticTypeID());
+            if (it != m_PersistentQueries.end())
+            {
+                auto* query = (PersistentQuery<Components...>*)it->second;
+                if (trackEntities)
+                {
+                    query->TrackEntities();
+                }
+                return *query;
+            }
+
+            auto* query = new PersistentQuery<Components...>({ EnsureArray<std::remove_const_t<Components>>()... }, trackEntities);
+            m_PersistentQueries[PersistentQuery<Components...>::StaticTypeID()] = query;
+            return *query;
+        }
+
+        // Runs every system recorded with a query's Schedule(), systems with non-conflicting
+        // component access run in parallel. The systems stay registered for the next call.
+        // Commands recorded by the systems are played back once they all finished.
+        void ExecuteScheduledSystems()
+        {
+            m_Scheduler.RunAll();
+            PlaybackCommands();
+        }
+
+        // The calling thread's command buffer. Structural changes can not be made directly from
+        // inside a Dispatch() or a scheduled system, record them here and play them back afterwards.
+        CommandBuffer& GetCommandBuffer()
+        {
+            return m_Commands.Local();
+        }
+
+        // Sync point, applies and clears every recorded command. Created entities are counted first,
+        // then component adds and removes run grouped by component type in entity order (so each storage
+        // is touched in one sequential pass), and destroys run last. Commands on the same entity and
+        // component keep the order they were recorded in by a thread.
+        void PlaybackCommands()
+        {
+            std::vector<Command*> commands;
+            m_Commands.ForEach([&](CommandBuffer& buffer)
+            {
+                for (Command& command : buffer.Commands())
+                {
+                    commands.push_back(&command);
+                }
+            });
+
+            if (commands.empty())
+            {
+                return;
+            }
+
+            auto stage = [](CommandType type)
+            {
+                return type == CommandType::Create ? 0 : (type == CommandType::Destroy ? 2 : 1);
+            };
+
+            std::sort(commands.begin(), commands.end(), [&](const Command* a, const Command* b)
+            {
+                if (stage(a->Type) != stage(b->Type)) return stage(a->Type) < stage(b->Type);
+                if (a->TypeID != b->TypeID) return a->TypeID < b->TypeID;
+                if (EntityIndex(a->Target) != EntityIndex(b->Target)) return EntityIndex(a->Target) < EntityIndex(b->Target);
+                return a->Order < b->Order;
+            });
+
+            for (Command* command : commands)
+            {
+                switch (command->Type)
+                {
+                case CommandType::Create:
+                    m_EntityCount.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                case CommandType::Add:
+                {
+                    if (!IsAlive(command->Target))
+                    {
+                        break;
+                    }
+
+                    IComponentStorage*& storage = m_Storages[command->TypeID];
+                    if (!storage)
+                    {
+                        command->CreateStorage(storage);
+                    }
+
+                    bool constructed = storage->Has(command->Target);
+                    if (constructed && storage->Kind() == StorageKind::SoA)
+                    {
+                        // Nothing to assign to, replace the component instead
+                        storage->Remove(command->Target);
+                        constructed = false;
+                    }
+
+                    void* dst = constructed ? storage->Get(command->Target) : storage->Add(command->Target);
+                    command->Construct(dst, command->Payload, constructed);
+                    command->Payload = nullptr;
+                    break;
+                }
+                case CommandType::Remove:
+                {
+                    IComponentStorage* storage = m_Storages[command->TypeID];
+                    if (storage && IsAlive(command->Target) && storage->Has(command->Target))
+                    {
+                        storage->Remove(command->Target);
+                    }
+                    break;
+                }
+                case CommandType::Destroy:
+                    DestroyEntity(command->Target);
+                    break;
+                }
+            }
+
+            m_Commands.ForEach([](CommandBuffer& buffer) { buffer.Clear(); });
+        }
+
+        void ClearScheduledSystems()
+        {
+            m_Scheduler.Clear();
         }
 
         void Clear()
         {
+            m_Commands.ForEach([](CommandBuffer& buffer) { buffer.Clear(); });
             m_Entities.Clear();
             m_EntityCount = 0;
 
@@ -114,19 +448,61 @@ namespace HBL2
         }
 
     private:
+        // Live handles of the span, deduplicated and in entity index order.
+        std::vector<Entity> AliveSorted(Span<const Entity> entities) const
+        {
+            std::vector<Entity> alive;
+            alive.reserve(entities.Size());
+            for (Entity e : entities)
+            {
+                if (m_Entities.IsAlive(e))
+                {
+                    alive.push_back(e);
+                }
+            }
+
+            std::sort(alive.begin(), alive.end(), EntityOrder());
+            alive.erase(std::unique(alive.begin(), alive.end()), alive.end());
+            return alive;
+        }
+
+        template<typename T, typename Func>
+        void WithSortableStorage(Func&& func)
+        {
+            IComponentStorage* storage = EnsureArray<T>();
+
+            switch (storage->Kind())
+            {
+            case StorageKind::Sparse:
+                func((SparseComponentStorage<T>*)storage);
+                break;
+            case StorageKind::SparsePaged:
+                func((PagedComponentStorage<T>*)storage);
+                break;
+            default:
+                HBL2_CORE_ASSERT(false, "Only sparse component storage can be sorted!");
+                break;
+            }
+        }
+
         template<typename T>
         IComponentStorage* EnsureArray()
         {
             uint8_t id = ComponentTypeID::Get<T>();
             if (!m_Storages[id])
             {
-                m_Storages[id] = (IComponentStorage*)new SparseComponentStorage<T>();
+                m_Storages[id] = (IComponentStorage*)new DefaultComponentStorage<T>();
             }
             return m_Storages[id];
         }
 
         EntityManager m_Entities;
-        uint32_t m_EntityCount = 0;
+        ArchetypeStorage m_Archetypes;
+        Scheduler m_Scheduler;
+        CommandBuffers m_Commands{ &m_Entities };
+        std::atomic<uint32_t> m_EntityCount{ 0 };
         IComponentStorage* m_Storages[MAX_COMPONENT_TYPES] = { nullptr };
+        std::vector<IGroupHandler*> m_Groups;
+        std::unordered_map<size_t, IStorageObserver*> m_PersistentQueries;
     };
 }
\ No newline at end of file
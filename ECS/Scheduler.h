@@ -0,0 +1,173 @@
+#pragma once
+
+#include "EntityManager.h"
+#include "../Utilities/JobSystem.h"
+
+#include <atomic>
+#include <bitset>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace HBL2
+{
+    using ComponentAccessMask = std::bitset<MAX_COMPONENT_TYPES>;
+
+    // A deferred system recorded by a query's Schedule(), with the components it reads and writes.
+    struct SystemEntry
+    {
+        ComponentAccessMask ReadMask;
+        ComponentAccessMask WriteMask;
+        std::function<void()> Task;
+    };
+
+    // Fills the access masks of a system from its component list, const components are read only.
+    template<typename... Components>
+    void FillSystemAccess(SystemEntry& entry)
+    {
+        ([&]
+        {
+            uint8_t id = ComponentTypeID::Get<std::remove_const_t<Components>>();
+            if constexpr (std::is_const_v<Components>)
+            {
+                entry.ReadMask.set(id);
+            }
+            else
+            {
+                entry.WriteMask.set(id);
+            }
+        }(), ...);
+    }
+
+    // Runs the recorded systems as a dependency graph. A system depends on every earlier registered
+    // system it conflicts with (write/write or read/write overlap) and is released as soon as all of
+    // them finished, there is no barrier between unrelated systems.
+    //
+    // The graph is compiled once into a flat plan and reused every frame, it is only rebuilt after a
+    // system is registered. A frame costs one atomic decrement per edge.
+    class Scheduler
+    {
+    public:
+        void Register(SystemEntry&& entry)
+        {
+            m_Entries.push_back(std::move(entry));
+            m_Dirty = true;
+        }
+
+        void Clear()
+        {
+            m_Entries.clear();
+            m_Plan = CompiledPlan{};
+            m_Pending.reset();
+            m_Dirty = false;
+        }
+
+        size_t Size() const { return m_Entries.size(); }
+
+        void RunAll()
+        {
+            if (m_Dirty)
+            {
+                Compile();
+            }
+
+            if (m_Plan.Roots.empty())
+            {
+                return;
+            }
+
+            JobContext ctx;
+            for (uint32_t system : m_Plan.Roots)
+            {
+                Launch(ctx, system);
+            }
+            JobSystem::Get().Wait(ctx);
+        }
+
+    private:
+        // Immutable between registrations. The successors of system i are
+        // Successors[SuccessorOffsets[i] .. SuccessorOffsets[i + 1]).
+        struct CompiledPlan
+        {
+            std::vector<uint32_t> Predecessors;
+            std::vector<uint32_t> SuccessorOffsets;
+            std::vector<uint32_t> Successors;
+            std::vector<uint32_t> Roots;
+        };
+
+        void Launch(JobContext& ctx, uint32_t system)
+        {
+            JobSystem::Get().Execute(ctx, [this, &ctx, system]()
+            {
+                m_Entries[system].Task();
+                Release(ctx, system);
+            });
+        }
+
+        void Release(JobContext& ctx, uint32_t system)
+        {
+            for (uint32_t i = m_Plan.SuccessorOffsets[system]; i < m_Plan.SuccessorOffsets[system + 1]; ++i)
+            {
+                uint32_t next = m_Plan.Successors[i];
+
+                // The last predecessor to finish re-arms the counter for the next frame and releases the system
+                if (m_Pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    m_Pending[next].store(m_Plan.Predecessors[next], std::memory_order_relaxed);
+                    Launch(ctx, next);
+                }
+            }
+        }
+
+        void Compile()
+        {
+            m_Plan = CompiledPlan{};
+
+            const uint32_t count = (uint32_t)m_Entries.size();
+            m_Plan.Predecessors.assign(count, 0);
+            m_Plan.SuccessorOffsets.reserve(count + 1);
+            m_Plan.SuccessorOffsets.push_back(0);
+
+            // Registration order orients every conflicting pair
+            for (uint32_t a = 0; a < count; ++a)
+            {
+                for (uint32_t b = a + 1; b < count; ++b)
+                {
+                    if (Conflict(m_Entries[a], m_Entries[b]))
+                    {
+                        m_Plan.Successors.push_back(b);
+                        m_Plan.Predecessors[b]++;
+                    }
+                }
+                m_Plan.SuccessorOffsets.push_back((uint32_t)m_Plan.Successors.size());
+            }
+
+            m_Pending.reset(new std::atomic<uint32_t>[count]);
+            for (uint32_t system = 0; system < count; ++system)
+            {
+                m_Pending[system].store(m_Plan.Predecessors[system], std::memory_order_relaxed);
+
+                if (m_Plan.Predecessors[system] == 0)
+                {
+                    m_Plan.Roots.push_back(system);
+                }
+            }
+
+            m_Dirty = false;
+        }
+
+        static bool Conflict(const SystemEntry& a, const SystemEntry& b)
+        {
+            return
+                (a.WriteMask & b.WriteMask).any() ||   // WW conflict
+                (a.WriteMask & b.ReadMask).any() ||    // WR conflict
+                (a.ReadMask & b.WriteMask).any();      // RW conflict
+        }
+
+    private:
+        std::vector<SystemEntry> m_Entries;
+        CompiledPlan m_Plan;
+        std::unique_ptr<std::atomic<uint32_t>[]> m_Pending;
+        bool m_Dirty = false;
+    };
+}
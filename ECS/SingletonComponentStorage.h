@@ -13,6 +13,8 @@ namespace HBL2
 			if (m_Entity == UINT32_MAX)
 			{
 				m_Entity = e;
+				m_Mask.set(e);
+				NotifyAdd(e);
 				return &m_Component;
 			}
 
@@ -21,15 +23,17 @@ namespace HBL2
 
 		virtual void Remove(Entity e) override
 		{
-			if (m_Entity == e)
+			if (m_Entity != UINT32_MAX && EntityIndex(m_Entity) == EntityIndex(e))
 			{
 				m_Entity = UINT32_MAX;
+				m_Mask.reset(e);
+				NotifyRemove(e);
 			}
 		}
 
 		virtual void* Get(Entity e) override
 		{
-			if (m_Entity == e)
+			if (m_Entity != UINT32_MAX && EntityIndex(m_Entity) == EntityIndex(e))
 			{
 				return &m_Component;
 			}
@@ -39,7 +43,7 @@ namespace HBL2
 
 		virtual bool Has(Entity e) override
 		{
-			if (m_Entity == e)
+			if (m_Entity != UINT32_MAX && EntityIndex(m_Entity) == EntityIndex(e))
 			{
 				return true;
 			}
@@ -56,7 +60,14 @@ namespace HBL2
 			return { &m_Entity, 1 };
 		}
 
-		virtual void Clear() override { m_Entity = UINT32_MAX; }
+		virtual StorageKind Kind() const override { return StorageKind::Singleton; }
+
+		virtual void Clear() override
+		{
+			m_Entity = UINT32_MAX;
+			m_Mask.clear();
+			NotifyClear();
+		}
 
 		virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
 		{
@@ -18,6 +18,7 @@ namespace HBL2
 				m_Entities.Add(e);
 				m_Components.Add(T{});
 				m_Mask.set(e);
+				NotifyAdd(e);
 				return &m_Components[m_Size++];
 			}
 
@@ -30,7 +31,7 @@ namespace HBL2
 		{
 			for (size_t i = 0; i < m_Size; ++i)
 			{
-				if (m_Entities[i] == e)
+				if (EntityIndex(m_Entities[i]) == EntityIndex(e))
 				{
 					// Swap with last element and pop (avoid shifting elements)
 					if (i < m_Size - 1)
@@ -43,6 +44,7 @@ namespace HBL2
 					m_Entities.Pop();
 					m_Mask.reset(e);
 					m_Size--;
+					NotifyRemove(e);
 					return;
 				}
 			}
@@ -52,7 +54,7 @@ namespace HBL2
 		{
 			for (size_t i = 0; i < m_Size; ++i)
 			{
-				if (m_Entities[i] == e)
+				if (EntityIndex(m_Entities[i]) == EntityIndex(e))
 				{
 					return &m_Components[i];
 				}
@@ -71,7 +73,7 @@ namespace HBL2
 
 			for (size_t i = 0; i < m_Size; ++i)
 			{
-				if (m_Entities[i] == e)
+				if (EntityIndex(m_Entities[i]) == EntityIndex(e))
 				{
 					return true;
 				}
@@ -90,12 +92,15 @@ namespace HBL2
 			return { m_Entities.Data(), m_Size };
 		}
 
+		virtual StorageKind Kind() const override { return StorageKind::Small; }
+
 		virtual void Clear() override
 		{
 			m_Components.Clear();
 			m_Entities.Clear();
 			m_Mask.clear();
 			m_Size = 0;
+			NotifyClear();
 		}
 
 		virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
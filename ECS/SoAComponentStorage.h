@@ -0,0 +1,266 @@
+#pragma once
+
+#include "IComponentStorage.h"
+#include "Meta.h"
+
+#include <new>
+
+namespace HBL2
+{
+    static constexpr size_t SOA_COLUMN_ALIGNMENT = 32; // One AVX2 register
+
+    template<typename T>
+    class SoAComponentStorage;
+
+    // Proxy reference to one component of a SoAComponentStorage.
+    template<typename T>
+    class SoARef
+    {
+    public:
+        SoARef(SoAComponentStorage<T>* storage, uint32_t row)
+            : m_Storage(storage), m_Row(row)
+        {
+        }
+
+        template<auto Member>
+        auto& Get() const
+        {
+            return m_Storage->template Column<Member>()[m_Row];
+        }
+
+        T Load() const { return m_Storage->Gather(m_Row); }
+        void Store(const T& value) const { m_Storage->Scatter(m_Row, value); }
+
+        operator T() const { return Load(); }
+        const SoARef& operator=(const T& value) const { Store(value); return *this; }
+
+    private:
+        SoAComponentStorage<T>* m_Storage;
+        uint32_t m_Row;
+    };
+
+    // Stores every reflected member of T in its own aligned column, so that e.g. Position::x
+    // of all entities is contiguous and can be processed 8 floats per AVX2 op.
+    // The layout comes from the offsets recorded by Meta::Register<T>().Data<&T::Member>(),
+    // members that are not reflected are not stored.
+    //
+    // Use Column<&T::Member>() or Ref(e) for direct access, there is no addressable T per entity.
+    // Queries gather the components into scratch blocks and write them back (see RunGathered),
+    // the type erased Get asserts. The type erased Add constructs into a staging component that
+    // is written back to the columns on the next access to the storage, so the reference
+    // returned by Registry::AddComponent is only valid until then.
+    template<typename T>
+    class SoAComponentStorage : IComponentStorage
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "SoAComponentStorage requires trivially copyable components!");
+
+    public:
+        SoAComponentStorage(const Meta::TypeData& type)
+        {
+            HBL2_CORE_ASSERT(type.size == sizeof(T), "Type data does not describe the stored component!");
+
+            m_FieldIndex.resize(sizeof(T), UINT16_MAX);
+            for (const Meta::MemberData& member : type.members)
+            {
+                m_FieldIndex[member.offset] = (uint16_t)m_Columns.size();
+                m_Columns.push_back({ member.offset, member.size, nullptr });
+            }
+        }
+
+        ~SoAComponentStorage()
+        {
+            for (Col& col : m_Columns)
+            {
+                ::operator delete(col.Data, std::align_val_t(SOA_COLUMN_ALIGNMENT));
+            }
+        }
+
+        virtual void* Add(Entity e) override
+        {
+            Flush();
+
+            uint32_t row = (uint32_t)m_Indices.size();
+            if (row == m_Capacity)
+            {
+                Grow(m_Capacity ? m_Capacity * 2 : 64);
+            }
+
+            if (EntityIndex(e) >= m_Positions.size())
+            {
+                m_Positions.resize(EntityIndex(e) + 1, UINT32_MAX);
+            }
+
+            m_Positions[EntityIndex(e)] = row;
+            m_Indices.push_back(e);
+            m_Mask.set(e);
+
+            Scatter(row, T{});
+            NotifyAdd(e);
+
+            m_Staging = T{};
+            m_StagedRow = row;
+            return &m_Staging;
+        }
+
+        virtual void Remove(Entity e) override
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+
+            Flush();
+
+            uint32_t row = m_Positions[EntityIndex(e)];
+            uint32_t last = (uint32_t)m_Indices.size() - 1;
+
+            // Swap-remove column by column, the last row has nothing to move
+            if (row != last)
+            {
+                for (Col& col : m_Columns)
+                {
+                    std::memcpy(col.Data + row * col.Size, col.Data + last * col.Size, col.Size);
+                }
+            }
+
+            Entity lastEntity = m_Indices[last];
+            m_Indices[row] = lastEntity;
+            m_Positions[EntityIndex(lastEntity)] = row;
+            m_Indices.pop_back();
+            m_Positions[EntityIndex(e)] = UINT32_MAX;
+
+            m_Mask.reset(e);
+
+            NotifyRemove(e);
+        }
+
+        virtual void* Get(Entity) override
+        {
+            HBL2_CORE_ASSERT(false, "SoA components have no addressable T, use Ref(e) or Column<&T::Member>()!");
+            return nullptr;
+        }
+
+        virtual bool Has(Entity e) override
+        {
+            return m_Mask.test(e);
+        }
+
+        virtual ComponentMaskAVX& Mask() const override { return const_cast<ComponentMaskAVX&>(m_Mask); }
+
+        virtual const Span<const Entity> Indices() const override
+        {
+            return m_Indices;
+        }
+
+        virtual StorageKind Kind() const override { return StorageKind::SoA; }
+
+        virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
+        {
+            SoAComponentStorage* self = const_cast<SoAComponentStorage*>(this);
+            self->Flush();
+
+            for (uint32_t row = 0, n = (uint32_t)m_Indices.size(); row < n; ++row)
+            {
+                T value = self->Gather(row);
+                callback(&value);
+                self->Scatter(row, value);
+            }
+        }
+
+        virtual void Clear() override
+        {
+            for (Entity e : m_Indices)
+            {
+                m_Positions[EntityIndex(e)] = UINT32_MAX;
+            }
+
+            m_Indices.clear();
+            m_Mask.clear();
+            m_StagedRow = UINT32_MAX;
+
+            NotifyClear();
+        }
+
+        // Contiguous column of a reflected member, one element per component in Indices() order.
+        template<auto Member>
+        auto Column()
+        {
+            using FieldT = std::remove_reference_t<decltype(std::declval<T>().*Member)>;
+
+            Flush();
+
+            size_t offset = reinterpret_cast<size_t>(&(reinterpret_cast<T*>(0)->*Member));
+            HBL2_CORE_ASSERT(m_FieldIndex[offset] != UINT16_MAX, "Member is not reflected!");
+
+            return Span<FieldT>((FieldT*)m_Columns[m_FieldIndex[offset]].Data, m_Indices.size());
+        }
+
+        SoARef<T> Ref(Entity e)
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+            return SoARef<T>(this, m_Positions[EntityIndex(e)]);
+        }
+
+        T Gather(uint32_t row)
+        {
+            Flush();
+
+            T value{};
+            for (const Col& col : m_Columns)
+            {
+                std::memcpy((uint8_t*)&value + col.Offset, col.Data + row * col.Size, col.Size);
+            }
+            return value;
+        }
+
+        void Scatter(uint32_t row, const T& value)
+        {
+            for (Col& col : m_Columns)
+            {
+                std::memcpy(col.Data + row * col.Size, (const uint8_t*)&value + col.Offset, col.Size);
+            }
+        }
+
+        // Writes the staged component back to its row.
+        void Flush()
+        {
+            if (m_StagedRow != UINT32_MAX)
+            {
+                Scatter(m_StagedRow, m_Staging);
+                m_StagedRow = UINT32_MAX;
+            }
+        }
+
+    private:
+        struct Col
+        {
+            size_t Offset;
+            size_t Size;
+            uint8_t* Data;
+        };
+
+        void Grow(uint32_t capacity)
+        {
+            for (Col& col : m_Columns)
+            {
+                uint8_t* data = (uint8_t*)::operator new(capacity * col.Size, std::align_val_t(SOA_COLUMN_ALIGNMENT));
+                if (col.Data)
+                {
+                    std::memcpy(data, col.Data, m_Capacity * col.Size);
+                    ::operator delete(col.Data, std::align_val_t(SOA_COLUMN_ALIGNMENT));
+                }
+                col.Data = data;
+            }
+
+            m_Capacity = capacity;
+        }
+
+    private:
+        std::vector<Col> m_Columns;
+        std::vector<uint16_t> m_FieldIndex;
+        std::vector<Entity> m_Indices;
+        std::vector<uint32_t> m_Positions;
+        ComponentMaskAVX m_Mask;
+        uint32_t m_Capacity = 0;
+
+        T m_Staging{};
+        uint32_t m_StagedRow = UINT32_MAX;
+    };
+}
@@ -1,20 +1,45 @@
 ﻿#pragma once
 
 #include "IComponentStorage.h"
+#include "PagedArray.h"
+
+#include <algorithm>
 
 namespace HBL2
 {
     static constexpr size_t PAGE_SIZE = 2048; // 1KB pages (adjust based on benchmarking)
     static constexpr size_t PAGE_MASK = PAGE_SIZE - 1; // 0x3FF for masking
     static constexpr size_t PAGE_SHIFT = 11; // log2(1024) = 10 for shifting
-    static constexpr Entity NO_ENTITY = UINT32_MAX;
-    static constexpr uint32_t INDEX_BITS = 20;
-    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1; // 0xFFFF
+    static constexpr uint32_t INDEX_BITS = ENTITY_INDEX_BITS; // One component per possible entity index
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
     static constexpr uint32_t VERSION_SHIFT = INDEX_BITS;
 
-    template<typename T>
-    class SparseComponentStorage : IComponentStorage
+    // Implemented by owning groups, notified by the storages they own on structural changes.
+    class IGroupHandler
+    {
+    public:
+        virtual ~IGroupHandler() = default;
+
+        virtual void OnAdd(Entity e) = 0;
+        virtual void OnRemove(Entity e) = 0;
+        virtual void OnClear() = 0;
+        virtual size_t TypeID() const = 0;
+    };
+
+    // Default sort order, ascending entity index. A storage sorted this way is walked
+    // sequentially by mask-AND queries, which visit entities in ascending index order.
+    struct EntityOrder
+    {
+        bool operator()(Entity a, Entity b) const { return EntityIndex(a) < EntityIndex(b); }
+    };
+
+    // TPacked selects the packed array container, std::vector<T> for contiguous storage or
+    // PagedArray<T> for O(1) growth with pointer stability across Add (see PagedComponentStorage).
+    template<typename T, typename TPacked = std::vector<T>>
+    class SparseComponentStorage final : IComponentStorage
     {
+        static constexpr bool IsPaged = !std::is_same_v<TPacked, std::vector<T>>;
+
     public:
         SparseComponentStorage() = default;
 
@@ -28,18 +53,31 @@ namespace HBL2
             mask.set(e);
 
             EnsurePage(e);
-            auto& iv = (*sparsePages[e >> PAGE_SHIFT])[e & PAGE_MASK];
+            auto& iv = Slot(e);
             iv = PackIndexVersion(idx, UnpackVersion(iv));
 
-            return &packed.back();
+            if (m_Group)
+            {
+                // The group may swap the new component into its packed prefix.
+                m_Group->OnAdd(e);
+            }
+
+            NotifyAdd(e);
+
+            return &packed[UnpackIndex(iv)];
         }
 
         virtual void Remove(Entity e) override
         {
             HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
 
+            if (m_Group)
+            {
+                m_Group->OnRemove(e);
+            }
+
             // Lookup packed index & bump version
-            uint32_t& iv = (*sparsePages[e >> PAGE_SHIFT])[e & PAGE_MASK];
+            uint32_t& iv = Slot(e);
             uint32_t old = iv;
             size_t idx = UnpackIndex(old);
             uint32_t ver = UnpackVersion(old) + 1;
@@ -53,7 +91,7 @@ namespace HBL2
             indices.pop_back();                        // *pop* from indices
 
             // Update sparse entry for the swapped entity
-            auto& siv = (*sparsePages[lastEntity >> PAGE_SHIFT])[lastEntity & PAGE_MASK];
+            auto& siv = Slot(lastEntity);
             siv = PackIndexVersion(uint32_t(idx), UnpackVersion(siv));
 
             // Tombstone the removed slot and bump its version
@@ -61,20 +99,93 @@ namespace HBL2
 
             // Clear the bit
             mask.reset(e);
+
+            // The swapped-in element breaks the incrementally sorted prefix
+            m_SortedCount = std::min(m_SortedCount, (uint32_t)idx);
+
+            NotifyRemove(e);
+        }
+
+        // Removals run in descending packed order, so every swap pulls in a survivor from the tail and
+        // each slot is written once. Mask bits are cleared word-wise afterwards. Owned storages keep
+        // the per entity path, their group reorders the packed prefix on every removal.
+        virtual void RemoveRange(Span<const Entity> entities) override
+        {
+            if (m_Group)
+            {
+                IComponentStorage::RemoveRange(entities);
+                return;
+            }
+
+            std::vector<uint32_t> positions;
+            positions.reserve(entities.Size());
+            for (Entity e : entities)
+            {
+                if (Has(e))
+                {
+                    positions.push_back(UnpackIndex(Slot(e)));
+                }
+            }
+
+            if (positions.empty())
+            {
+                return;
+            }
+
+            std::sort(positions.begin(), positions.end(), std::greater<uint32_t>());
+            positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+            std::vector<Entity> removed;
+            removed.reserve(positions.size());
+
+            for (uint32_t idx : positions)
+            {
+                Entity e = indices[idx];
+                removed.push_back(e);
+
+                uint32_t& iv = Slot(e);
+                uint32_t ver = UnpackVersion(iv) + 1;
+
+                if (idx != indices.size() - 1)
+                {
+                    Entity lastEntity = indices.back();
+                    packed[idx] = std::move(packed.back());
+                    indices[idx] = lastEntity;
+
+                    auto& siv = Slot(lastEntity);
+                    siv = PackIndexVersion(idx, UnpackVersion(siv));
+                }
+
+                packed.pop_back();
+                indices.pop_back();
+
+                iv = PackIndexVersion(INDEX_MASK, ver);
+            }
+
+            std::sort(removed.begin(), removed.end(), EntityOrder());
+            mask.reset_many(removed.data(), removed.size());
+
+            m_SortedCount = std::min(m_SortedCount, positions.back());
+
+            for (Entity e : removed)
+            {
+                NotifyRemove(e);
+            }
         }
 
         virtual bool Has(Entity e) override
         {
-            size_t p = e >> PAGE_SHIFT;
+            uint32_t index = EntityIndex(e);
+            size_t p = index >> PAGE_SHIFT;
             if (p >= sparsePages.size() || !sparsePages[p]) return false;
-            uint32_t iv = (*sparsePages[p])[e & PAGE_MASK];
-            return UnpackIndex(iv) != INDEX_MASK;  // only 0xFFFF is invalid now
+            uint32_t iv = (*sparsePages[p])[index & PAGE_MASK];
+            return UnpackIndex(iv) != INDEX_MASK;  // only INDEX_MASK is invalid
         }
 
         virtual void* Get(Entity e) override
         {
             HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
-            uint32_t iv = (*sparsePages[e >> PAGE_SHIFT])[e & PAGE_MASK];
+            uint32_t iv = Slot(e);
             return &packed[UnpackIndex(iv)];
         }
 
@@ -85,18 +196,44 @@ namespace HBL2
             return indices;
         }
 
+        virtual StorageKind Kind() const override
+        {
+            return IsPaged ? StorageKind::SparsePaged : StorageKind::Sparse;
+        }
+
         virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
         {
-            for (size_t i = 0, n = packed.size(); i < n; ++i)
+            if constexpr (IsPaged)
             {
-                callback((void*)&packed[i]);
+                for (size_t b = 0, blocks = packed.block_count(); b < blocks; ++b)
+                {
+                    T* block = packed.block(b);
+                    for (size_t i = 0, n = packed.block_size(b); i < n; ++i)
+                    {
+                        callback((void*)&block[i]);
+                    }
+                }
+            }
+            else
+            {
+                for (size_t i = 0, n = packed.size(); i < n; ++i)
+                {
+                    callback((void*)&packed[i]);
+                }
             }
         }
 
         virtual void Clear() override
         {
+            if (m_Group)
+            {
+                m_Group->OnClear();
+            }
+
             packed.clear();
             indices.clear();
+            mask.clear();
+            m_SortedCount = 0;
 
             for (auto* page : sparsePages)
             {
@@ -104,12 +241,233 @@ namespace HBL2
             }
 
             sparsePages.clear();
+
+            NotifyClear();
+        }
+
+        // Position of the entity's component in the packed array.
+        uint32_t Index(Entity e)
+        {
+            return UnpackIndex(Slot(e));
+        }
+
+        // Swaps two packed slots, keeping indices and the sparse lookup in sync.
+        void Swap(uint32_t a, uint32_t b)
+        {
+            if (a == b)
+            {
+                return;
+            }
+
+            Entity ea = indices[a];
+            Entity eb = indices[b];
+
+            std::swap(packed[a], packed[b]);
+            std::swap(indices[a], indices[b]);
+
+            auto& iva = Slot(ea);
+            auto& ivb = Slot(eb);
+            iva = PackIndexVersion(b, UnpackVersion(iva));
+            ivb = PackIndexVersion(a, UnpackVersion(ivb));
         }
 
+        T* Data() requires (!IsPaged) { return packed.data(); }
+
+        // Bulk Add of values[i] for entities[i], none of the entities may have the component yet.
+        // The packed and index arrays grow once (a memmove for trivially copyable T) and the mask
+        // is set a word at a time. Groups and observers are still notified per entity.
+        void AddRange(Span<const Entity> entities, const T* values)
+        {
+            const size_t count = entities.Size();
+            if (count == 0)
+            {
+                return;
+            }
+
+            // Checked before anything is touched, a duplicate would leave two packed slots for one entity
+            for (Entity e : entities)
+            {
+                HBL2_CORE_ASSERT(!Has(e), "Entity already has the component.");
+            }
+
+            const uint32_t first = (uint32_t)packed.size();
+
+            if constexpr (IsPaged)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    packed.push_back(values[i]);
+                }
+            }
+            else
+            {
+                packed.insert(packed.end(), values, values + count);
+            }
+
+            indices.insert(indices.end(), entities.begin(), entities.end());
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                Entity e = entities[i];
+
+                EnsurePage(e);
+                auto& iv = Slot(e);
+                HBL2_CORE_ASSERT(UnpackIndex(iv) == INDEX_MASK, "Entity appears twice in the range.");
+                iv = PackIndexVersion(first + (uint32_t)i, UnpackVersion(iv));
+            }
+
+            mask.set_many(entities.Data(), count);
+
+            if (m_Group || HasObservers())
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (m_Group)
+                    {
+                        m_Group->OnAdd(entities[i]);
+                    }
+
+                    NotifyAdd(entities[i]);
+                }
+            }
+        }
+
+        // Calls func(T*, size_t) for each contiguous run of the packed array, in Indices() order.
+        // That is the whole array for vector storage and one run per block when paged.
+        template<typename Func>
+        void ForEachBlock(Func&& func)
+        {
+            if constexpr (IsPaged)
+            {
+                for (size_t b = 0, n = packed.block_count(); b < n; ++b)
+                {
+                    func(packed.block(b), packed.block_size(b));
+                }
+            }
+            else if (!packed.empty())
+            {
+                func(packed.data(), packed.size());
+            }
+        }
+
+        // Reorders the packed array by cmp, which compares either two components or two entities.
+        template<typename Compare>
+        void Sort(Compare cmp)
+        {
+            HBL2_CORE_ASSERT(!m_Group, "Cannot sort a storage owned by a group!");
+
+            std::vector<uint32_t> order(indices.size());
+            for (uint32_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return Less(cmp, a, b); });
+
+            // Apply the permutation in place one cycle at a time, slot i receives the element that was at
+            // order[i]. Placed slots are marked by order[j] == j, so every element is moved exactly once.
+            for (uint32_t i = 0; i < order.size(); ++i)
+            {
+                if (order[i] == i)
+                {
+                    continue;
+                }
+
+                T value = std::move(packed[i]);
+                Entity entity = indices[i];
+
+                uint32_t j = i;
+                while (order[j] != i)
+                {
+                    uint32_t from = order[j];
+                    packed[j] = std::move(packed[from]);
+                    indices[j] = indices[from];
+                    order[j] = j;
+                    j = from;
+                }
+
+                packed[j] = std::move(value);
+                indices[j] = entity;
+                order[j] = j;
+            }
+
+            // Rebuild the sparse entries in a single pass
+            for (uint32_t i = 0; i < indices.size(); ++i)
+            {
+                auto& iv = Slot(indices[i]);
+                iv = PackIndexVersion(i, UnpackVersion(iv));
+            }
+
+            m_SortedCount = 0;
+        }
+
+        // Moves the entities of 'order' that have this component to the front, in that order.
+        // The remaining components keep their relative order after them.
+        void Respect(Span<const Entity> order)
+        {
+            HBL2_CORE_ASSERT(!m_Group, "Cannot sort a storage owned by a group!");
+
+            uint32_t pos = 0;
+            for (Entity e : order)
+            {
+                if (Has(e))
+                {
+                    Swap(Index(e), pos++);
+                }
+            }
+
+            m_SortedCount = 0;
+        }
+
+        // One bounded step of an insertion sort that resumes where the previous step stopped, meant to be
+        // called once per frame with the same cmp. Stops after about 'budget' comparisons and returns true
+        // once the whole array is sorted. Nearly sorted data, e.g. slowly moving spatial keys, costs O(n).
+        template<typename Compare>
+        bool SortIncremental(Compare cmp, size_t budget)
+        {
+            HBL2_CORE_ASSERT(!m_Group, "Cannot sort a storage owned by a group!");
+
+            size_t comparisons = 0;
+            while (m_SortedCount < indices.size() && comparisons < budget)
+            {
+                uint32_t j = m_SortedCount++;
+                while (j > 0 && (++comparisons, Less(cmp, j, j - 1)))
+                {
+                    Swap(j, j - 1);
+                    --j;
+                }
+            }
+
+            return m_SortedCount == indices.size();
+        }
+
+        IGroupHandler* Group() const { return m_Group; }
+        void SetGroup(IGroupHandler* group) { m_Group = group; }
+
     private:
+        template<typename Compare>
+        bool Less(Compare& cmp, uint32_t a, uint32_t b)
+        {
+            if constexpr (std::is_invocable_r_v<bool, Compare&, const T&, const T&>)
+            {
+                return cmp(std::as_const(packed[a]), std::as_const(packed[b]));
+            }
+            else
+            {
+                return cmp(indices[a], indices[b]);
+            }
+        }
+
+        // Sparse entry of the entity, keyed by its index so stale generations map to the same slot.
+        uint32_t& Slot(Entity e)
+        {
+            uint32_t index = EntityIndex(e);
+            return (*sparsePages[index >> PAGE_SHIFT])[index & PAGE_MASK];
+        }
+
         void EnsurePage(Entity e)
         {
-            size_t p = e >> PAGE_SHIFT;
+            size_t p = EntityIndex(e) >> PAGE_SHIFT;
             if (p >= sparsePages.size())
             {
                 sparsePages.resize(p + 1, nullptr);
@@ -134,8 +492,13 @@ namespace HBL2
 
     private:
         ComponentMaskAVX mask;
-        std::vector<T> packed;
+        TPacked packed;
         std::vector<Entity> indices;
         std::vector<std::array<uint32_t, PAGE_SIZE>*> sparsePages;
+        IGroupHandler* m_Group = nullptr;
+        uint32_t m_SortedCount = 0; // Sorted prefix of SortIncremental
     };
+
+    template<typename T>
+    using PagedComponentStorage = SparseComponentStorage<T, PagedArray<T>>;
 }
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "IComponentStorage.h"
+#include "SparseComponentStorage.h"
+
+namespace HBL2
+{
+    // Components that only carry membership: empty types, or types flagged with
+    // 'static constexpr bool IsTag = true;'. Any data members of a flagged type are not stored.
+    template<typename T>
+    constexpr bool IsTagComponent = std::is_empty_v<T> || requires { requires T::IsTag; };
+
+    // Stores only the mask plus a dense list of the entities, kept up to date with a swap-remove on
+    // every Remove so that Indices() never writes and can be called from parallel readers.
+    // The list positions live in pages allocated on demand, like the sparse storage's sparse table.
+    // Every entity of a storage shares the storage's one value.
+    template<typename T>
+    class TagComponentStorage final : IComponentStorage
+    {
+    public:
+        TagComponentStorage() = default;
+        TagComponentStorage(const TagComponentStorage&) = delete;
+        TagComponentStorage& operator=(const TagComponentStorage&) = delete;
+
+        ~TagComponentStorage()
+        {
+            for (auto* page : m_PositionPages)
+            {
+                delete page;
+            }
+        }
+
+        virtual void* Add(Entity e) override
+        {
+            HBL2_CORE_ASSERT(!Has(e), "Entity already has requested component.");
+
+            EnsurePage(e);
+            Position(e) = (uint32_t)m_Entities.size();
+            m_Entities.push_back(e);
+            m_Mask.set(e);
+
+            NotifyAdd(e);
+
+            return &m_Value;
+        }
+
+        virtual void Remove(Entity e) override
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+
+            uint32_t pos = Position(e);
+            Entity lastEntity = m_Entities.back();
+            m_Entities[pos] = lastEntity;
+            Position(lastEntity) = pos;
+            m_Entities.pop_back();
+
+            m_Mask.reset(e);
+
+            NotifyRemove(e);
+        }
+
+        virtual void* Get(Entity e) override
+        {
+            HBL2_CORE_ASSERT(Has(e), "Entity does not have requested component.");
+            return &m_Value;
+        }
+
+        virtual bool Has(Entity e) override
+        {
+            return m_Mask.test(e);
+        }
+
+        virtual ComponentMaskAVX& Mask() const override { return const_cast<ComponentMaskAVX&>(m_Mask); }
+
+        virtual const Span<const Entity> Indices() const override
+        {
+            return m_Entities;
+        }
+
+        virtual StorageKind Kind() const override { return StorageKind::Tag; }
+
+        virtual void IterateRaw(TrampolineFunction<void, void*>& callback) const override
+        {
+            for (size_t i = 0, n = m_Entities.size(); i < n; ++i)
+            {
+                callback((void*)&m_Value);
+            }
+        }
+
+        virtual void Clear() override
+        {
+            for (auto* page : m_PositionPages)
+            {
+                delete page;
+            }
+
+            m_PositionPages.clear();
+            m_Entities.clear();
+            m_Mask.clear();
+
+            NotifyClear();
+        }
+
+        // The value handed out for every entity, queries use it directly instead of calling Get().
+        T& Value() { return m_Value; }
+
+    private:
+        // Position of the entity in m_Entities, only meaningful while the mask bit is set.
+        uint32_t& Position(Entity e)
+        {
+            uint32_t index = EntityIndex(e);
+            return (*m_PositionPages[index >> PAGE_SHIFT])[index & PAGE_MASK];
+        }
+
+        void EnsurePage(Entity e)
+        {
+            size_t p = EntityIndex(e) >> PAGE_SHIFT;
+            if (p >= m_PositionPages.size())
+            {
+                m_PositionPages.resize(p + 1, nullptr);
+            }
+            if (!m_PositionPages[p])
+            {
+                m_PositionPages[p] = new std::array<uint32_t, PAGE_SIZE>();
+            }
+        }
+
+    private:
+        ComponentMaskAVX m_Mask;
+        std::vector<Entity> m_Entities;
+        std::vector<std::array<uint32_t, PAGE_SIZE>*> m_PositionPages;
+        T m_Value{};
+    };
+
+    // Storage created for a component type that has not been configured with Registry::SetStorageType.
+    template<typename T>
+    using DefaultComponentStorage = std::conditional_t<IsTagComponent<T>, TagComponentStorage<T>, SparseComponentStorage<T>>;
+}
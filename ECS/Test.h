@@ -11,6 +11,9 @@
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
 
 namespace HBL2
 {
@@ -95,7 +98,7 @@ namespace HBL2
     struct Velocity { float dx, dy, dz; };
     struct Collider { float radius; };
     struct AIState { int state; };
-    struct CameraTag { int tag = 1; };
+    struct CameraTag { int tag = 1; static constexpr bool IsTag = true; };
 
     //------------------------------------------------------------------------------
     // 2) Test parameters
@@ -263,6 +266,1561 @@ namespace HBL2
         }
     }
 
+    //------------------------------------------------------------------------------
+    // 4) Behavior tests
+    //------------------------------------------------------------------------------
+
+    void test_archetype_storage()
+    {
+        struct Name { std::vector<int> id; };
+
+        Registry reg;
+        reg.SetStorageType<Position, ArchetypeComponentStorage<Position>>();
+        reg.SetStorageType<Velocity, ArchetypeComponentStorage<Velocity>>();
+        reg.SetStorageType<Name, ArchetypeComponentStorage<Name>>();
+
+        std::vector<Entity> ents(5000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+
+            if (i % 2)
+            {
+                reg.AddComponent<Velocity>(ents[i], { 1, 1, 1 });
+            }
+
+            if (i % 3 == 0)
+            {
+                reg.AddComponent<Name>(ents[i], { std::vector<int>(2, (int)i) });
+            }
+        }
+
+        // Moving an entity to another archetype has to carry its other components along
+        for (size_t i = 0; i < ents.size(); i += 4)
+        {
+            reg.AddComponent<Velocity>(ents[i], { 2, 2, 2 });
+        }
+        for (size_t i = 1; i < ents.size(); i += 4)
+        {
+            reg.RemoveComponent<Velocity>(ents[i]);
+        }
+
+        size_t moved = 0;
+        reg.Filter<Position, Velocity>().ForEach([&](Position& p, Velocity& v)
+        {
+            p.x += v.dx;
+            moved++;
+        }).Run();
+
+        size_t unnamed = 0;
+        reg.Filter<Position, Velocity>().Exclude<Name>().ForEach([&](Position&, Velocity&)
+        {
+            unnamed++;
+        }).Run();
+
+        size_t expectedUnnamed = 0;
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            bool hasVelocity = i % 4 == 0 || i % 4 == 3;
+            float expected = (float)i + (i % 4 == 0 ? 2.0f : (i % 4 == 3 ? 1.0f : 0.0f));
+            assert(reg.GetComponent<Position>(ents[i]).x == expected);
+            assert(reg.HasComponent<Velocity>(ents[i]) == hasVelocity);
+
+            if (i % 3 == 0)
+            {
+                assert(reg.GetComponent<Name>(ents[i]).id[1] == (int)i);
+            }
+            else if (hasVelocity)
+            {
+                expectedUnnamed++;
+            }
+        }
+
+        assert(moved == ents.size() / 2);
+        assert(unnamed == expectedUnnamed);
+
+        std::cout << "Archetype storage tests passed\n";
+    }
+
+    void test_owning_groups()
+    {
+        Registry reg;
+
+        std::vector<Entity> ents(3000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+
+            if (i % 2 == 0)
+            {
+                reg.AddComponent<Velocity>(ents[i], { (float)i, 0, 0 });
+            }
+        }
+
+        auto& group = reg.Group<Position, Velocity>();
+        assert((&group == &reg.Group<Position, Velocity>()));
+
+        // Structural changes after the group exists keep its prefix in sync
+        for (size_t i = 1; i < ents.size(); i += 4)
+        {
+            reg.AddComponent<Velocity>(ents[i], { (float)i, 0, 0 });
+        }
+        for (size_t i = 0; i < ents.size(); i += 6)
+        {
+            reg.RemoveComponent<Position>(ents[i]);
+        }
+        for (size_t i = 2; i < ents.size(); i += 10)
+        {
+            reg.RemoveComponent<Velocity>(ents[i]);
+        }
+
+        size_t expected = 0;
+        for (Entity e : ents)
+        {
+            expected += reg.HasComponent<Position>(e) && reg.HasComponent<Velocity>(e);
+        }
+
+        size_t matched = 0;
+        group.ForEach([&](Position& p, Velocity& v)
+        {
+            assert(p.x == v.dx);
+            matched++;
+        }).Run();
+
+        auto grouped = group.Entities();
+        assert(matched == expected);
+        assert(grouped.Size() == expected);
+
+        for (size_t i = 0; i < grouped.Size(); ++i)
+        {
+            assert(reg.GetComponent<Position>(grouped[i]).x == (float)EntityIndex(grouped[i]));
+            assert(reg.GetComponent<Velocity>(grouped[i]).dx == (float)EntityIndex(grouped[i]));
+        }
+
+        std::cout << "Owning group tests passed\n";
+    }
+
+    void test_paged_storage()
+    {
+        struct Name { std::vector<int> id; };
+
+        Registry reg;
+        reg.SetStorageType<Position, PagedComponentStorage<Position>>();
+        reg.SetStorageType<Name, PagedComponentStorage<Name>>();
+
+        Entity first = reg.CreateEntity();
+        Position* stable = &reg.AddComponent<Position>(first, { 42, 0, 0 });
+
+        std::vector<Entity> ents(10000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+            reg.AddComponent<Name>(ents[i], { std::vector<int>(1, (int)i) });
+        }
+
+        // Growing the storage never relocates components that are already there
+        assert(stable == &reg.GetComponent<Position>(first));
+        assert(stable->x == 42);
+
+        for (size_t i = 0; i < ents.size(); i += 3)
+        {
+            reg.RemoveComponent<Position>(ents[i]);
+            reg.RemoveComponent<Name>(ents[i]);
+        }
+
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            if (i % 3)
+            {
+                assert(reg.GetComponent<Position>(ents[i]).x == (float)i);
+                assert(reg.GetComponent<Name>(ents[i]).id[0] == (int)i);
+            }
+        }
+
+        size_t matched = 0;
+        reg.Filter<Position, Name>().ForEach([&](Position& p, Name& n)
+        {
+            assert(n.id[0] == (int)p.x);
+            matched++;
+        }).Run();
+
+        assert(matched == ents.size() - (ents.size() + 2) / 3);
+
+        std::cout << "Paged storage tests passed\n";
+    }
+
+    void test_soa_storage()
+    {
+        Meta::Context ctx;
+        Meta::Register<Position>(ctx)
+            .Data<&Position::x>("x")
+            .Data<&Position::y>("y")
+            .Data<&Position::z>("z");
+
+        Registry reg;
+        reg.SetStorageType<Position, SoAComponentStorage<Position>>(Meta::Resolve<Position>(ctx));
+
+        std::vector<Entity> ents(1000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, (float)(2 * i), 0 });
+
+            if (i % 2)
+            {
+                reg.AddComponent<Velocity>(ents[i], { 1, 1, 1 });
+            }
+        }
+
+        for (size_t i = 0; i < ents.size(); i += 5)
+        {
+            reg.RemoveComponent<Position>(ents[i]);
+        }
+
+        // Queries work on gathered copies, the mutable columns are written back after each block
+        reg.Filter<Position, const Velocity>().ForEach([](Position& p, const Velocity& v)
+        {
+            p.x += v.dx;
+        }).Run();
+
+        auto& storage = reg.GetStorage<Position, SoAComponentStorage<Position>>();
+        auto xs = storage.Column<&Position::x>();
+        Span<const Entity> rows = ((IComponentStorage*)&storage)->Indices();
+
+        assert(xs.Size() == 800);
+        assert((uintptr_t)xs.Data() % 32 == 0);
+
+        for (size_t i = 0; i < xs.Size(); ++i)
+        {
+            uint32_t index = EntityIndex(rows[i]);
+            assert(xs[i] == (float)index + (index % 2 ? 1.0f : 0.0f));
+            assert(storage.Ref(rows[i]).Get<&Position::y>() == (float)(2 * index));
+        }
+
+        reg.Filter<Position, Velocity>().ForEachChunk([](Span<Position> positions, Span<Velocity>)
+        {
+            for (size_t i = 0; i < positions.Size(); ++i)
+            {
+                positions[i].z = 9;
+            }
+        });
+        assert(storage.Ref(ents[1]).Load().z == 9);
+        assert(storage.Ref(ents[2]).Load().z == 0);
+
+        size_t persistent = 0;
+        reg.PersistentFilter<Position, Velocity>().ForEach([&](Position& p, Velocity&)
+        {
+            p.y = -1;
+            persistent++;
+        }).Run();
+        assert(persistent == 400);
+        assert(storage.Ref(ents[3]).Load().y == -1);
+        assert(storage.Ref(ents[2]).Load().y == 4);
+
+        // Played back commands replace the whole component
+        reg.GetCommandBuffer().AddComponent<Position>(ents[1], { 5, 5, 5 });
+        reg.PlaybackCommands();
+        assert(storage.Ref(ents[1]).Load().x == 5);
+        assert(storage.Ref(ents[1]).Load().z == 5);
+
+        std::cout << "SoA storage tests passed\n";
+    }
+
+    void test_tag_storage()
+    {
+        struct Enemy {};
+
+        static_assert(IsTagComponent<CameraTag> && IsTagComponent<Enemy> && !IsTagComponent<Position>);
+
+        Registry reg;
+
+        std::vector<Entity> ents(5000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+
+            if (i % 2)
+            {
+                reg.AddComponent<CameraTag>(ents[i]);
+            }
+
+            if (i % 3 == 0)
+            {
+                reg.AddComponent<Enemy>(ents[i]);
+            }
+        }
+
+        for (size_t i = 1; i < ents.size(); i += 4)
+        {
+            reg.RemoveComponent<CameraTag>(ents[i]);
+        }
+
+        size_t tagged = 0;
+        reg.Filter<Position, CameraTag>().ForEach([&](Position& p, CameraTag& tag)
+        {
+            assert((size_t)p.x % 4 == 3);
+            assert(tag.tag == 1);
+            tagged++;
+        }).Run();
+
+        size_t friendly = 0;
+        reg.Filter<Position, CameraTag>().Exclude<Enemy>().ForEach([&](Position& p, CameraTag&)
+        {
+            assert((size_t)p.x % 3 != 0);
+            friendly++;
+        }).Run();
+
+        size_t expectedTagged = 0, expectedFriendly = 0;
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            if (i % 4 == 3)
+            {
+                expectedTagged++;
+                expectedFriendly += i % 3 != 0;
+            }
+        }
+        assert(tagged == expectedTagged);
+        assert(friendly == expectedFriendly);
+
+        // The entity list holds full, live handles
+        auto& storage = reg.GetStorage<CameraTag, TagComponentStorage<CameraTag>>();
+        Span<const Entity> members = ((IComponentStorage*)&storage)->Indices();
+        assert(members.Size() == expectedTagged);
+        for (Entity e : members)
+        {
+            assert(reg.IsAlive(e) && reg.HasComponent<CameraTag>(e));
+        }
+
+        // Every registry keeps its own tag value
+        Registry other;
+        other.AddComponent<CameraTag>(other.CreateEntity()).tag = 7;
+        assert(storage.Value().tag == 1);
+
+        std::cout << "Tag storage tests passed\n";
+    }
+
+    void test_persistent_queries()
+    {
+        struct Enemy {};
+
+        Registry reg;
+
+        std::vector<Entity> ents(3000);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            ents[i] = reg.CreateEntity();
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+
+            if (i % 2)
+            {
+                reg.AddComponent<Velocity>(ents[i]);
+            }
+        }
+
+        auto& moving = reg.PersistentFilter<Position, Velocity>();
+        auto& enemies = reg.PersistentFilter<Position, Enemy>(true);
+        assert((&moving == &reg.PersistentFilter<Position, Velocity>()));
+
+        // The masks follow every add and remove made after the query was created
+        for (size_t i = 0; i < ents.size(); i += 3)
+        {
+            reg.AddComponent<Enemy>(ents[i]);
+        }
+        for (size_t i = 0; i < ents.size(); i += 2)
+        {
+            reg.AddComponent<Velocity>(ents[i]);
+        }
+        for (size_t i = 0; i < ents.size(); i += 5)
+        {
+            reg.RemoveComponent<Position>(ents[i]);
+        }
+
+        size_t expectedMoving = 0, expectedEnemies = 0;
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            expectedMoving += i % 5 != 0;
+            expectedEnemies += i % 5 != 0 && i % 3 == 0;
+        }
+
+        size_t movingCount = 0;
+        moving.ForEach([&](Position&, Velocity&) { movingCount++; }).Run();
+
+        size_t enemyCount = 0;
+        enemies.ForEach([&](Position& p, Enemy&)
+        {
+            assert((size_t)p.x % 3 == 0 && (size_t)p.x % 5 != 0);
+            enemyCount++;
+        }).Run();
+
+        assert(movingCount == expectedMoving);
+        assert(enemyCount == expectedEnemies);
+        assert(enemies.Entities().Size() == expectedEnemies);
+        assert(moving.Mask().count() == expectedMoving);
+
+        reg.Clear();
+        assert(moving.Mask().count() == 0);
+
+        std::cout << "Persistent query tests passed\n";
+    }
+
+    void test_sort_respect()
+    {
+        struct Key { uint32_t k; };
+
+        std::mt19937 rng(3);
+        Registry reg;
+        reg.SetStorageType<Velocity, PagedComponentStorage<Velocity>>();
+
+        std::vector<Entity> ents(4000);
+        reg.CreateEntities(ents);
+        std::shuffle(ents.begin(), ents.end(), rng);
+
+        // Components are added in shuffled order, so the packed arrays start out of entity order
+        for (Entity e : ents)
+        {
+            reg.AddComponent<Position>(e, { (float)EntityIndex(e), 0, 0 });
+            reg.AddComponent<Key>(e, { (uint32_t)(rng() % 1000) });
+
+            if (rng() % 2)
+            {
+                reg.AddComponent<Velocity>(e, { (float)EntityIndex(e), 0, 0 });
+            }
+        }
+        for (size_t i = 0; i < 500; ++i)
+        {
+            reg.RemoveComponent<Position>(ents[i]);
+        }
+
+        reg.Sort<Position>();
+
+        auto& positions = reg.GetStorage<Position, SparseComponentStorage<Position>>();
+        Span<const Entity> positionOrder = ((IComponentStorage*)&positions)->Indices();
+        for (size_t i = 0; i < positionOrder.Size(); ++i)
+        {
+            assert(i == 0 || EntityIndex(positionOrder[i - 1]) < EntityIndex(positionOrder[i]));
+            assert(positions.Data()[i].x == (float)EntityIndex(positionOrder[i]));
+            assert(reg.GetComponent<Position>(positionOrder[i]).x == (float)EntityIndex(positionOrder[i]));
+        }
+
+        reg.Sort<Key>([](const Key& a, const Key& b) { return a.k < b.k; });
+
+        auto& keys = reg.GetStorage<Key, SparseComponentStorage<Key>>();
+        size_t keyCount = ((IComponentStorage*)&keys)->Indices().Size();
+        for (size_t i = 1; i < keyCount; ++i)
+        {
+            assert(keys.Data()[i - 1].k <= keys.Data()[i].k);
+        }
+
+        // Velocities of entities that also have a Position come first, in the Position order
+        reg.Respect<Velocity, Position>();
+
+        auto& velocities = reg.GetStorage<Velocity, PagedComponentStorage<Velocity>>();
+        Span<const Entity> velocityOrder = ((IComponentStorage*)&velocities)->Indices();
+        size_t withPosition = 0;
+        for (size_t i = 0; i < velocityOrder.Size(); ++i)
+        {
+            assert(reg.GetComponent<Velocity>(velocityOrder[i]).dx == (float)EntityIndex(velocityOrder[i]));
+            withPosition += reg.HasComponent<Position>(velocityOrder[i]);
+        }
+        for (size_t i = 0; i < withPosition; ++i)
+        {
+            assert(reg.HasComponent<Position>(velocityOrder[i]));
+            assert(i == 0 || EntityIndex(velocityOrder[i - 1]) < EntityIndex(velocityOrder[i]));
+        }
+
+        // Incremental sorting spreads the work over several calls and ends in the same order
+        auto descending = [](const Key& a, const Key& b) { return a.k > b.k; };
+        size_t steps = 0;
+        while (!reg.SortIncremental<Key>(100, descending))
+        {
+            steps++;
+        }
+        assert(steps > 0);
+
+        for (size_t i = 1; i < keyCount; ++i)
+        {
+            assert(keys.Data()[i - 1].k >= keys.Data()[i].k);
+        }
+        for (size_t i = 0; i < keyCount; ++i)
+        {
+            Entity e = ((IComponentStorage*)&keys)->Indices()[i];
+            assert(reg.GetComponent<Key>(e).k == keys.Data()[i].k);
+        }
+
+        std::cout << "Sort and Respect tests passed\n";
+    }
+
+    void test_scheduled_queries()
+    {
+        struct Enemy {};
+
+        JobSystem::Initialize();
+
+        {
+            Registry reg;
+
+            std::vector<Entity> ents(1000);
+            for (size_t i = 0; i < ents.size(); ++i)
+            {
+                ents[i] = reg.CreateEntity();
+                reg.AddComponent<Position>(ents[i], { 0, 0, 0 });
+                reg.AddComponent<Velocity>(ents[i], { 1, 1, 1 });
+                reg.AddComponent<AIState>(ents[i], { 0 });
+
+                if (i % 2)
+                {
+                    reg.AddComponent<Enemy>(ents[i]);
+                }
+            }
+
+            reg.Filter<Position, const Velocity>().ForEach([](Position& p, const Velocity& v) { p.x += v.dx; }).Schedule();
+            reg.Filter<AIState>().ForEach([](AIState& ai) { ai.state++; }).Schedule();
+            reg.Filter<Position, const Velocity>().Exclude<Enemy>().ForEach([](Position& p, const Velocity&) { p.y += 1; }).Schedule();
+            reg.Filter<Velocity>().ForEach([](Velocity& v) { v.dz += 1; }).Schedule();
+
+            // The compiled plan is reused across frames
+            for (int frame = 0; frame < 3; ++frame)
+            {
+                reg.ExecuteScheduledSystems();
+            }
+
+            for (size_t i = 0; i < ents.size(); ++i)
+            {
+                const Position& p = reg.GetComponent<Position>(ents[i]);
+                assert(p.x == 3 && p.y == (i % 2 ? 0 : 3));
+                assert(reg.GetComponent<AIState>(ents[i]).state == 3);
+                assert(reg.GetComponent<Velocity>(ents[i]).dz == 4);
+            }
+        }
+
+        {
+            Registry reg;
+            Entity e = reg.CreateEntity();
+            reg.AddComponent<Position>(e);
+            reg.AddComponent<AIState>(e);
+
+            // The AIState system shares nothing with the Position writers, so it must not wait behind them.
+            // The first writer holds on until the AIState system is done, bounded so a wrong plan fails the order check.
+            const bool parallel = JobSystem::Get().GetThreadCount() >= 2;
+            std::atomic<int> sequence = 0;
+            std::atomic<int> slowSeq = -1, writerSeq = -1, aiSeq = -1;
+            reg.Filter<Position>().ForEach([&](Position&)
+            {
+                for (uint32_t spins = 0; parallel && aiSeq < 0 && spins < 10000000; ++spins)
+                {
+                    std::this_thread::yield();
+                }
+                slowSeq = sequence++;
+            }).Schedule();
+            reg.Filter<Position>().ForEach([&](Position& p) { p.x = 1; writerSeq = sequence++; }).Schedule();
+            reg.Filter<AIState>().ForEach([&](AIState&) { aiSeq = sequence++; }).Schedule();
+
+            reg.ExecuteScheduledSystems();
+            assert(slowSeq >= 0 && slowSeq < writerSeq);
+            assert(aiSeq < slowSeq || !parallel);
+            assert(reg.GetComponent<Position>(e).x == 1);
+
+            // Scheduled systems read the entity count when they run, not when they were scheduled
+            reg.ClearScheduledSystems();
+
+            size_t seen = 0;
+            reg.Filter<Position, AIState>().ForEach([&](Position&, AIState&) { seen++; }).Schedule();
+
+            for (int i = 0; i < 100; ++i)
+            {
+                Entity spawned = reg.CreateEntity();
+                reg.AddComponent<Position>(spawned);
+                reg.AddComponent<AIState>(spawned);
+            }
+
+            reg.ExecuteScheduledSystems();
+            assert(seen == 101);
+        }
+
+        JobSystem::Shutdown();
+
+        std::cout << "Scheduled query tests passed\n";
+    }
+
+    void test_command_buffers()
+    {
+        struct Self { Entity e; };
+        struct Payload { std::vector<int> data; };
+
+        JobSystem::Initialize();
+
+        {
+            Registry reg;
+
+            const size_t count = 6000;
+            for (size_t i = 0; i < count; ++i)
+            {
+                Entity e = reg.CreateEntity();
+                reg.AddComponent<Position>(e, { 0, 0, 0 });
+                reg.AddComponent<Self>(e, { e });
+            }
+
+            // Structural changes recorded from worker threads during a parallel dispatch
+            reg.Filter<Position, const Self>().ForEach([&](Position&, const Self& self)
+            {
+                CommandBuffer& commands = reg.GetCommandBuffer();
+
+                if (self.e % 2 == 0)
+                {
+                    commands.AddComponent<Velocity>(self.e, { 2, 0, 0 });
+                }
+
+                if (self.e % 3 == 0)
+                {
+                    Entity spawned = commands.CreateEntity();
+                    commands.AddComponent<Position>(spawned, { 7, 0, 0 });
+                    commands.AddComponent<Self>(spawned, { spawned });
+                    commands.AddComponent<Payload>(spawned, Payload{ std::vector<int>(5, (int)spawned) });
+                }
+
+                if (self.e % 5 == 0)
+                {
+                    commands.RemoveComponent<Position>(self.e);
+                    commands.AddComponent<Position>(self.e, { 9, 0, 0 });
+                }
+            }).Dispatch();
+
+            // Nothing is visible before playback
+            assert(reg.GetEntityCount() == count);
+
+            reg.PlaybackCommands();
+
+            size_t spawnedCount = (count + 2) / 3;
+            assert(reg.GetEntityCount() == count + spawnedCount);
+
+            size_t velocities = 0, spawnedPositions = 0, replacedPositions = 0, payloads = 0;
+            reg.Filter<Velocity>().ForEach([&](Velocity& v) { velocities += v.dx == 2; }).Run();
+            reg.Filter<Position>().ForEach([&](Position& p)
+            {
+                spawnedPositions += p.x == 7;
+                replacedPositions += p.x == 9;
+            }).Run();
+            reg.Filter<Payload, const Self>().ForEach([&](Payload& payload, const Self& self)
+            {
+                payloads += payload.data.size() == 5 && payload.data[0] == (int)self.e;
+            }).Run();
+
+            assert(velocities == count / 2);
+            assert(spawnedPositions == spawnedCount);
+            assert(replacedPositions == count / 5);
+            assert(payloads == spawnedCount);
+
+            // Adding a component the entity already has replaces it, lvalues are copied into the buffer
+            Entity target = 4;
+            Velocity lvalue = { 8, 0, 0 };
+            const Velocity constant = { 9, 0, 0 };
+
+            reg.GetCommandBuffer().AddComponent<Velocity>(target, lvalue);
+            reg.PlaybackCommands();
+            assert(reg.GetComponent<Velocity>(target).dx == 8);
+
+            reg.GetCommandBuffer().AddComponent(target, constant);
+            reg.PlaybackCommands();
+            assert(reg.GetComponent<Velocity>(target).dx == 9);
+
+            // Commands that are never played back release their payloads with the registry
+            reg.GetCommandBuffer().AddComponent<Payload>(reg.GetCommandBuffer().CreateEntity(), Payload{ std::vector<int>(3) });
+        }
+
+        {
+            // Threads outside the job system racing for the shared buffer all get the same one
+            Registry reg;
+            std::vector<CommandBuffer*> buffers(8);
+            std::vector<std::thread> threads;
+
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+                threads.emplace_back([&, i]() { buffers[i] = &reg.GetCommandBuffer(); });
+            }
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+            for (CommandBuffer* buffer : buffers)
+            {
+                assert(buffer == buffers[0]);
+            }
+        }
+
+        JobSystem::Shutdown();
+
+        std::cout << "Command buffer tests passed\n";
+    }
+
+    void test_bulk_create_add()
+    {
+        struct Payload { std::vector<int> data; };
+
+        Registry reg;
+        reg.SetStorageType<Velocity, PagedComponentStorage<Velocity>>();
+
+        auto& tracked = reg.PersistentFilter<Position, AIState>(true);
+
+        const uint32_t count = 50000;
+        std::vector<Entity> ents(count);
+        assert(reg.CreateEntities(ents) == count);
+        assert(reg.GetEntityCount() == count);
+
+        std::vector<Position> positions(count);
+        std::vector<Velocity> velocities(count);
+        std::vector<Payload> payloads(count);
+        std::vector<AIState> states(count / 2);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            positions[i] = { (float)i, 1, 0 };
+            velocities[i] = { (float)i, 0, 0 };
+            payloads[i].data.assign(3, (int)i);
+        }
+        for (uint32_t i = 0; i < count / 2; ++i)
+        {
+            states[i] = { (int)i };
+        }
+
+        // Sparse, paged and non trivially copyable storages all take the bulk path
+        reg.AddComponents<Position>(ents, Span<const Position>(positions));
+        reg.AddComponents<Velocity>(ents, Span<const Velocity>(velocities));
+        reg.AddComponents<Payload>(ents, Span<const Payload>(payloads));
+
+        std::vector<Entity> firstHalf(ents.begin(), ents.begin() + count / 2);
+        reg.AddComponents<AIState>(firstHalf, Span<const AIState>(states));
+
+        for (uint32_t i = 0; i < count; i += 7)
+        {
+            assert(reg.GetComponent<Position>(ents[i]).x == (float)i);
+            assert(reg.GetComponent<Velocity>(ents[i]).dx == (float)i);
+            assert(reg.GetComponent<Payload>(ents[i]).data[2] == (int)i);
+            assert(reg.HasComponent<AIState>(ents[i]) == (i < count / 2));
+        }
+
+        size_t matched = 0;
+        reg.Filter<Position, AIState>().ForEach([&](Position& p, AIState& ai) { matched += (int)p.x == ai.state; }).Run();
+        assert(matched == count / 2);
+        assert(tracked.Entities().Size() == count / 2);
+
+        // Recycled and fresh slots mix in one batch
+        for (uint32_t i = 0; i < 100; ++i)
+        {
+            reg.DestroyEntity(ents[i * 3]);
+        }
+
+        std::vector<Entity> more(300);
+        assert(reg.CreateEntities(more) == 300);
+        for (Entity e : more)
+        {
+            assert(reg.IsAlive(e) && !reg.HasComponent<Position>(e));
+        }
+        assert(reg.GetEntityCount() == count + 200);
+
+        // A batch larger than the remaining capacity is cut short
+        Registry small;
+        small.SetEntityCapacity(100);
+
+        std::vector<Entity> batch(150);
+        assert(small.CreateEntities(batch) == 100);
+        assert(batch[99] != NO_ENTITY && batch[100] == NO_ENTITY);
+        assert(small.CreateEntity() == NO_ENTITY);
+
+        std::cout << "Bulk create and add tests passed\n";
+    }
+
+    void test_bulk_remove_destroy()
+    {
+        struct Payload { std::vector<int> data; };
+        struct Enemy {};
+
+        // Two identical registries, one changed through the bulk calls and one entity by entity
+        auto build = [](Registry& reg, std::vector<Entity>& ents)
+        {
+            std::mt19937 rng(7);
+            reg.SetStorageType<Velocity, PagedComponentStorage<Velocity>>();
+
+            ents.resize(20000);
+            reg.CreateEntities(ents);
+
+            for (Entity e : ents)
+            {
+                if (rng() % 2) reg.AddComponent<Position>(e, { (float)e, 0, 0 });
+                if (rng() % 3) reg.AddComponent<Velocity>(e, { (float)e, 0, 0 });
+                if (rng() % 4 == 0) reg.AddComponent<Payload>(e, { std::vector<int>(2, (int)e) });
+                if (rng() % 5 == 0) reg.AddComponent<Enemy>(e);
+            }
+        };
+
+        Registry bulk, single;
+        std::vector<Entity> ents, singleEnts;
+        build(bulk, ents);
+        build(single, singleEnts);
+
+        auto& bulkQuery = bulk.PersistentFilter<Position, Velocity>(true);
+        auto& singleQuery = single.PersistentFilter<Position, Velocity>(true);
+
+        std::mt19937 rng(3);
+        std::vector<Entity> doomed;
+        for (size_t i = 0; i < 8000; ++i)
+        {
+            doomed.push_back(ents[rng() % ents.size()]);
+        }
+
+        // Duplicates and already destroyed handles are skipped
+        doomed.push_back(doomed[0]);
+
+        bulk.DestroyEntities(doomed);
+        for (Entity e : doomed)
+        {
+            single.DestroyEntity(e);
+        }
+
+        auto sums = [](Registry& reg)
+        {
+            double position = 0, velocity = 0, payload = 0;
+            reg.Filter<Position>().ForEach([&](Position& p) { position += p.x; }).Run();
+            reg.Filter<Velocity>().ForEach([&](Velocity& v) { velocity += v.dx; }).Run();
+            reg.Filter<Payload>().ForEach([&](Payload& p) { payload += p.data[1]; }).Run();
+            return std::array<double, 3>{ position, velocity, payload };
+        };
+
+        assert(bulk.GetEntityCount() == single.GetEntityCount());
+        assert(sums(bulk) == sums(single));
+        assert(bulkQuery.Entities().Size() == singleQuery.Entities().Size());
+
+        for (Entity e : ents)
+        {
+            assert(bulk.IsAlive(e) == single.IsAlive(e));
+
+            if (bulk.IsAlive(e))
+            {
+                assert(bulk.HasComponent<Position>(e) == single.HasComponent<Position>(e));
+                assert(bulk.HasComponent<Enemy>(e) == single.HasComponent<Enemy>(e));
+            }
+        }
+
+        std::vector<Entity> odd;
+        for (Entity e : ents)
+        {
+            if (bulk.IsAlive(e) && e % 2)
+            {
+                odd.push_back(e);
+            }
+        }
+
+        bulk.RemoveComponents<Position>(odd);
+        bulk.RemoveComponents<Enemy>(odd);
+        for (Entity e : odd)
+        {
+            single.RemoveComponent<Position>(e);
+            single.RemoveComponent<Enemy>(e);
+        }
+
+        assert(sums(bulk) == sums(single));
+        assert(bulkQuery.Entities().Size() == singleQuery.Entities().Size());
+
+        for (Entity e : ents)
+        {
+            if (bulk.IsAlive(e) && bulk.HasComponent<Position>(e))
+            {
+                assert(e % 2 == 0 && bulk.GetComponent<Position>(e).x == (float)e);
+            }
+        }
+
+        std::cout << "Bulk remove and destroy tests passed\n";
+    }
+
+    void test_job_system()
+    {
+        JobSystem::Initialize(4);
+        JobSystem& jobs = JobSystem::Get();
+        assert(jobs.GetThreadCount() == 4);
+        assert(jobs.GetWorkerIndex() == 0);
+
+        {
+            // Jobs pushed by worker 0 sit in its deque, the other workers can only get them by stealing.
+            // A job popped by worker 0 holds it until some other worker stole one.
+            const uint32_t count = 2000;
+            std::atomic<uint32_t> ran = 0;
+            std::atomic<uint32_t> stolen = 0;
+            JobContext ctx;
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                jobs.Execute(ctx, [&]()
+                {
+                    if (JobSystem::Get().GetWorkerIndex() == 0)
+                    {
+                        while (stolen.load() == 0)
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                    else
+                    {
+                        stolen++;
+                    }
+                    ran++;
+                });
+            }
+
+            jobs.Wait(ctx);
+            assert(ran == count);
+            assert(stolen > 0);
+            assert(ctx.counter == 0);
+        }
+
+        {
+            // Once the 4096 slot deque of worker 0 is full, Execute runs the job inline instead.
+            // Thieves take one job each and block on the gate, so the deque can not drain meanwhile.
+            const uint32_t capacity = 4096;
+            const uint32_t count = capacity + 1000;
+            const std::thread::id caller = std::this_thread::get_id();
+            std::atomic<bool> submitted = false;
+            std::atomic<bool> gate = false;
+            std::atomic<uint32_t> inlined = 0;
+            std::atomic<uint32_t> ran = 0;
+            JobContext ctx;
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                jobs.Execute(ctx, [&]()
+                {
+                    if (std::this_thread::get_id() == caller && !submitted)
+                    {
+                        inlined++;
+                    }
+                    else
+                    {
+                        while (!gate)
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                    ran++;
+                });
+            }
+
+            submitted = true;
+            gate = true;
+            jobs.Wait(ctx);
+
+            assert(ran == count);
+            assert(inlined >= count - capacity - (jobs.GetThreadCount() - 1));
+            assert(inlined <= count - capacity);
+        }
+
+        {
+            // Dispatch covers [0, jobCount) exactly once, in groups of at most groupSize
+            const uint32_t jobCount = 10007;
+            const uint32_t groupSize = 64;
+            std::vector<std::atomic<uint32_t>> hits(jobCount);
+            std::atomic<uint32_t> groups = 0;
+            std::function<void(uint32_t, uint32_t)> func = [&](uint32_t first, uint32_t last)
+            {
+                assert(first < last && last - first <= groupSize);
+                for (uint32_t i = first; i < last; ++i)
+                {
+                    hits[i]++;
+                }
+                groups++;
+            };
+
+            JobContext ctx;
+            jobs.Dispatch(ctx, jobCount, groupSize, func);
+            jobs.Wait(ctx);
+
+            assert(groups == (jobCount + groupSize - 1) / groupSize);
+            for (std::atomic<uint32_t>& hit : hits)
+            {
+                assert(hit == 1);
+            }
+        }
+
+        {
+            // Jobs submitted from threads outside the job system go through the injection queue,
+            // and a job may wait on jobs of its own without blocking its worker.
+            std::atomic<uint32_t> ran = 0;
+            JobContext outer;
+
+            std::thread external([&]()
+            {
+                assert(JobSystem::Get().GetWorkerIndex() == -1);
+
+                for (uint32_t i = 0; i < 64; ++i)
+                {
+                    JobSystem::Get().Execute(outer, [&]()
+                    {
+                        JobContext inner;
+                        for (uint32_t j = 0; j < 16; ++j)
+                        {
+                            JobSystem::Get().Execute(inner, [&]() { ran++; });
+                        }
+                        JobSystem::Get().Wait(inner);
+                        ran++;
+                    });
+                }
+            });
+            external.join();
+
+            jobs.Wait(outer);
+            assert(ran == 64 * 17);
+        }
+
+        JobSystem::Shutdown();
+
+        {
+            // Without workers every job runs inline
+            JobContext ctx;
+            bool ran = false;
+            JobSystem::Get().Execute(ctx, [&]() { ran = true; });
+            assert(ran && ctx.counter == 0);
+        }
+
+        std::cout << "Job system tests passed\n";
+    }
+
+    void test_entity_handles()
+    {
+        {
+            Registry reg;
+
+            Entity first = reg.CreateEntity();
+            reg.AddComponent<Position>(first, { 1, 0, 0 });
+            reg.DestroyEntity(first);
+
+            // The slot is recycled with a new generation, the old handle stays stale
+            Entity second = reg.CreateEntity();
+            assert(EntityIndex(second) == EntityIndex(first));
+            assert(EntityGeneration(second) == EntityGeneration(first) + 1);
+            assert(!reg.IsAlive(first) && reg.IsAlive(second));
+            assert(!reg.HasComponent<Position>(first) && !reg.HasComponent<Position>(second));
+
+            reg.AddComponent<Position>(second, { 2, 0, 0 });
+            reg.RemoveComponent<Position>(first);
+            reg.DestroyEntity(first);
+            assert(reg.IsAlive(second) && reg.GetComponent<Position>(second).x == 2);
+
+            // Generations wrap within their bits instead of spilling into the index
+            Entity current = second;
+            for (uint32_t i = 0; i <= ENTITY_GENERATION_MASK; ++i)
+            {
+                reg.DestroyEntity(current);
+                current = reg.CreateEntity();
+                assert(EntityIndex(current) == EntityIndex(first));
+            }
+            assert(EntityGeneration(current) == EntityGeneration(second));
+
+            // Clear keeps every handle from before it stale, also for recreated indices
+            std::vector<Entity> before(100);
+            reg.CreateEntities(before);
+            reg.Clear();
+            assert(reg.GetEntityCount() == 0);
+
+            std::vector<Entity> after(100);
+            reg.CreateEntities(after);
+            for (Entity e : before)
+            {
+                assert(!reg.IsAlive(e));
+            }
+            for (Entity e : after)
+            {
+                assert(reg.IsAlive(e));
+            }
+        }
+
+        {
+            // Concurrent create and destroy churn on one manager, single and bulk creates mixed.
+            // A destroyed handle is stale right away and every live handle owns a distinct index.
+            JobSystem::Initialize(8);
+
+            EntityManager entities;
+            const uint32_t jobCount = 32;
+            std::vector<std::vector<Entity>> alive(jobCount);
+            JobContext ctx;
+
+            for (uint32_t j = 0; j < jobCount; ++j)
+            {
+                JobSystem::Get().Execute(ctx, [&, j]()
+                {
+                    std::mt19937 rng(j);
+                    std::vector<Entity>& mine = alive[j];
+
+                    for (uint32_t i = 0; i < 4000; ++i)
+                    {
+                        if (i % 50 == 0)
+                        {
+                            Entity batch[32];
+                            uint32_t created = entities.Create(32, batch);
+                            assert(created == 32);
+                            mine.insert(mine.end(), batch, batch + created);
+                        }
+                        else
+                        {
+                            mine.push_back(entities.Create());
+                        }
+
+                        if (rng() % 2)
+                        {
+                            size_t victim = rng() % mine.size();
+                            Entity e = mine[victim];
+                            entities.Destroy(e);
+                            assert(!entities.IsAlive(e));
+
+                            mine[victim] = mine.back();
+                            mine.pop_back();
+                        }
+                    }
+                });
+            }
+            JobSystem::Get().Wait(ctx);
+
+            std::vector<uint32_t> indices;
+            for (uint32_t j = 0; j < jobCount; ++j)
+            {
+                for (Entity e : alive[j])
+                {
+                    assert(entities.IsAlive(e));
+                    indices.push_back(EntityIndex(e));
+                }
+            }
+
+            std::sort(indices.begin(), indices.end());
+            assert(std::adjacent_find(indices.begin(), indices.end()) == indices.end());
+            assert(entities.GetHighWaterMark() >= indices.size());
+
+            JobSystem::Shutdown();
+        }
+
+        std::cout << "Entity handle tests passed\n";
+    }
+
+    void test_component_masks()
+    {
+        std::mt19937 rng(5);
+
+        auto bits = [](const ComponentMaskAVX& mask)
+        {
+            std::vector<uint32_t> out;
+            for (Entity e : mask)
+            {
+                out.push_back(e);
+            }
+            return out;
+        };
+
+        {
+            // Masks only grow with the highest index set in them
+            ComponentMaskAVX mask;
+            assert(mask.capacity() == 0 && !mask.any());
+
+            mask.set(5);
+            assert(mask.capacity() == 64 * MASK_WORD_GRANULARITY);
+
+            mask.set(100000);
+            assert(mask.capacity() > 100000 && mask.capacity() < 4 * 100000);
+            assert(mask.test(5) && mask.test(100000) && !mask.test(6));
+            assert(mask.count() == 2 && mask.occupied_words() == 2);
+
+            // Resetting the last bit of a word clears its summary bit
+            mask.reset(5);
+            mask.reset(100000);
+            assert(!mask.any() && mask.occupied_words() == 0 && mask.begin() == mask.end());
+        }
+
+        for (int round = 0; round < 20; ++round)
+        {
+            // Checked against std::set, from a few bits in a large range to dense low ranges
+            uint32_t range = 1 + rng() % (round % 2 ? 1000000 : 5000);
+            uint32_t population = round % 3 == 0 ? 20 : 3000;
+
+            ComponentMaskAVX a, b;
+            std::set<uint32_t> setA, setB;
+            for (uint32_t i = 0; i < population; ++i)
+            {
+                uint32_t x = rng() % range;
+                uint32_t y = rng() % range;
+                a.set(x);
+                b.set(y);
+                setA.insert(x);
+                setB.insert(y);
+            }
+            for (uint32_t i = 0; i < population / 3; ++i)
+            {
+                uint32_t x = rng() % range;
+                a.reset(x);
+                setA.erase(x);
+            }
+
+            assert(bits(a) == std::vector<uint32_t>(setA.begin(), setA.end()));
+            assert(a.count() == setA.size());
+
+            std::vector<uint32_t> both, onlyA;
+            for (uint32_t x : setA)
+            {
+                (setB.count(x) ? both : onlyA).push_back(x);
+            }
+
+            assert(a.has_any(b) == !both.empty());
+
+            ComponentMaskAVX intersection = a;
+            intersection &= b;
+            assert(bits(intersection) == both);
+
+            ComponentMaskAVX difference = a;
+            difference -= b;
+            assert(bits(difference) == onlyA);
+
+            for (uint32_t x : both)
+            {
+                intersection.reset(x);
+            }
+            assert(!intersection.any() && intersection.occupied_words() == 0);
+        }
+
+        std::cout << "Component mask tests passed\n";
+    }
+
+    void test_entity_capacity()
+    {
+        {
+            Registry reg;
+            reg.SetEntityCapacity(100);
+
+            std::vector<Entity> first(80);
+            assert(reg.CreateEntities(first) == 80);
+
+            // A bulk create past the capacity creates what fits and fills the rest with NO_ENTITY
+            std::vector<Entity> rest(50);
+            assert(reg.CreateEntities(rest) == 20);
+            assert(rest[19] != NO_ENTITY && rest[20] == NO_ENTITY && rest[49] == NO_ENTITY);
+            assert(!reg.IsAlive(NO_ENTITY));
+            assert(reg.CreateEntity() == NO_ENTITY);
+            assert(reg.GetEntityCount() == 100);
+
+            // Destroyed slots are reused even at capacity
+            reg.DestroyEntity(first[3]);
+            Entity recycled = reg.CreateEntity();
+            assert(recycled != NO_ENTITY && EntityIndex(recycled) == EntityIndex(first[3]));
+            assert(reg.GetEntityCount() == 100);
+
+            // Command buffers record nothing for entities they could not create
+            assert(reg.GetCommandBuffer().CreateEntity() == NO_ENTITY);
+            assert(reg.GetCommandBuffer().Empty());
+        }
+
+        {
+            // Racing creators never push the high water mark past the capacity
+            JobSystem::Initialize(8);
+
+            Registry reg;
+            reg.SetEntityCapacity(5000);
+
+            std::atomic<uint32_t> created = 0;
+            std::atomic<uint32_t> failed = 0;
+            JobContext ctx;
+
+            for (uint32_t j = 0; j < 16; ++j)
+            {
+                JobSystem::Get().Execute(ctx, [&, j]()
+                {
+                    for (uint32_t i = 0; i < 200; ++i)
+                    {
+                        if (j % 2)
+                        {
+                            Entity batch[10];
+                            created += reg.CreateEntities(10, batch);
+                        }
+                        else if (reg.CreateEntity() != NO_ENTITY)
+                        {
+                            created++;
+                        }
+                        else
+                        {
+                            failed++;
+                        }
+                    }
+                });
+            }
+            JobSystem::Get().Wait(ctx);
+
+            assert(created == 5000 && failed > 0);
+            assert(reg.GetEntityCount() == 5000);
+
+            JobSystem::Shutdown();
+        }
+
+        std::cout << "Entity capacity tests passed\n";
+    }
+
+    void test_query_planner()
+    {
+        struct Rare { int id; };
+        struct Common { int id; };
+        struct Chunked { int id; };
+        struct Excluded {};
+
+        QueryCostModel::Get() = QueryCostModel{};
+
+        Registry reg;
+        reg.SetStorageType<Chunked, ArchetypeComponentStorage<Chunked>>();
+        reg.SetStorageType<Position, ArchetypeComponentStorage<Position>>();
+
+        const uint32_t count = 100000;
+        std::vector<Entity> ents(count);
+        reg.CreateEntities(ents);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            reg.AddComponent<Common>(ents[i], { (int)i });
+            reg.AddComponent<Velocity>(ents[i], { (float)i, 0, 0 });
+            reg.AddComponent<Chunked>(ents[i], { (int)i });
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+
+            if (i % 1000 == 0)
+            {
+                reg.AddComponent<Rare>(ents[i], { (int)i });
+            }
+
+            if (i % 4 == 0)
+            {
+                reg.AddComponent<Excluded>(ents[i]);
+            }
+        }
+
+        // A small storage next to a dense one is walked and probed, driven by the small one
+        QueryPlan probe = reg.Filter<Common, Rare>().Explain();
+        assert(probe.Strategy == QueryStrategy::Probe);
+        assert(probe.DrivingStorage == 1 && probe.DrivingCount == count / 1000);
+        assert(probe.EstimatedMatches == count / 1000);
+
+        // Two dense storages are cheaper to AND word by word than to probe entity by entity
+        QueryPlan dense = reg.Filter<Common, Velocity>().Explain();
+        assert(dense.Strategy == QueryStrategy::MaskAnd);
+        assert(dense.MaskCostNs < dense.ProbeCostNs);
+        assert(dense.EstimatedMatches == count);
+
+        // Only archetype backed components walk chunks, and only without excludes
+        QueryStrategy archetypes = reg.Filter<Chunked, Position>().Explain().Strategy;
+        QueryStrategy excluding = reg.Filter<Chunked, Position>().Exclude<Excluded>().Explain().Strategy;
+        QueryStrategy mixed = reg.Filter<Chunked, Velocity>().Explain().Strategy;
+        assert(archetypes == QueryStrategy::Chunks);
+        assert(excluding != QueryStrategy::Chunks);
+        assert(mixed != QueryStrategy::Chunks);
+
+        // Every strategy visits the same entities
+        size_t sum = 0;
+        QueryPlan probed = reg.Filter<Common, Rare>().ForEach([&](Common& c, Rare& r) { sum += c.id == r.id; }).Analyze();
+        assert(probed.Strategy == QueryStrategy::Probe && probed.ActualMatches == count / 1000 && sum == count / 1000);
+        assert(probed.ActualNs >= 0.0);
+
+        sum = 0;
+        QueryPlan anded = reg.Filter<Common, Velocity>().ForEach([&](Common& c, Velocity& v) { sum += c.id == (int)v.dx; }).Analyze();
+        assert(anded.Strategy == QueryStrategy::MaskAnd && anded.ActualMatches == count && sum == count);
+
+        sum = 0;
+        QueryPlan chunked = reg.Filter<Chunked, Position>().ForEach([&](Chunked& c, Position& p) { sum += c.id == (int)p.x; }).Analyze();
+        assert(chunked.Strategy == QueryStrategy::Chunks && chunked.ActualMatches == count && sum == count);
+
+        size_t kept = 0;
+        reg.Filter<Common, Velocity>().Exclude<Excluded>().ForEach([&](Common& c, Velocity&) { kept += c.id % 4 != 0; }).Run();
+        assert(kept == count - count / 4);
+
+        // Calibration replaces the defaults with positive measured costs
+        QueryCostModel::Calibrate(1 << 14);
+        const QueryCostModel& model = QueryCostModel::Get();
+        assert(model.ProbeNs > 0.0 && model.WordNs > 0.0 && model.VisitNs > 0.0 && model.FetchNs > 0.0);
+
+        std::ostringstream text;
+        probed.Print(text);
+        assert(text.str().find("QueryPlan: Probe") == 0);
+
+        QueryCostModel::Get() = QueryCostModel{};
+
+        std::cout << "Query planner tests passed\n";
+    }
+
+    void test_typed_storages()
+    {
+        struct Slot { int id; };
+
+        Meta::Context ctx;
+        Meta::Register<AIState>(ctx).Data<&AIState::state>("state");
+
+        // One component per storage kind, so every query below mixes direct, tag and virtual refs
+        Registry reg;
+        reg.SetStorageType<Velocity, PagedComponentStorage<Velocity>>();
+        reg.SetStorageType<Collider, ArchetypeComponentStorage<Collider>>();
+        reg.SetStorageType<AIState, SoAComponentStorage<AIState>>(Meta::Resolve<AIState>(ctx));
+        reg.SetStorageType<Slot, SmallComponentStorage<Slot, 64>>();
+
+        std::vector<Entity> ents(3000);
+        reg.CreateEntities(ents);
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            reg.AddComponent<Position>(ents[i], { (float)i, 0, 0 });
+            reg.AddComponent<Velocity>(ents[i], { 1, 0, 0 });
+            reg.AddComponent<Collider>(ents[i], { (float)i });
+            reg.AddComponent<AIState>(ents[i], { (int)i });
+
+            if (i % 2 == 0)
+            {
+                reg.AddComponent<CameraTag>(ents[i]);
+            }
+
+            if (i < 64)
+            {
+                reg.AddComponent<Slot>(ents[i], { (int)i });
+            }
+        }
+
+        // Sparse, paged, archetype and tag storages in one typed loop
+        size_t tagged = 0;
+        reg.Filter<Position, Velocity, Collider, CameraTag>().ForEach([&](Position& p, Velocity& v, Collider& c, CameraTag& tag)
+        {
+            p.x += v.dx;
+            v.dy = p.x;
+            c.radius += 1;
+            tagged += tag.tag == 1;
+        }).Run();
+        assert(tagged == ents.size() / 2);
+
+        // A SoA component switches the query to gathered blocks, mutable components are written back
+        reg.Filter<Position, const Velocity, AIState, Collider>().ForEach([](Position& p, const Velocity& v, AIState& ai, Collider& c)
+        {
+            ai.state += 1;
+            p.y = (float)ai.state + v.dx;
+            c.radius *= 2;
+        }).Run();
+
+        // Small storages go through the vtable, next to an exclude
+        reg.Filter<Slot, Position>().Exclude<CameraTag>().ForEach([](Slot& s, Position&) { s.id += 100; }).Run();
+
+        // Chunked iteration over a SoA column and a paged one
+        reg.Filter<AIState, Velocity>().ForEachChunk([](Span<AIState> states, Span<Velocity> velocities)
+        {
+            for (size_t i = 0; i < states.Size(); ++i)
+            {
+                states[i].state += 1000;
+                velocities[i].dz = 1;
+            }
+        });
+
+        auto& states = reg.GetStorage<AIState, SoAComponentStorage<AIState>>();
+        for (size_t i = 0; i < ents.size(); ++i)
+        {
+            bool even = i % 2 == 0;
+            float x = (float)i + (even ? 1.0f : 0.0f);
+            float radius = ((float)i + (even ? 1.0f : 0.0f)) * 2.0f;
+
+            const Position& p = reg.GetComponent<Position>(ents[i]);
+            const Velocity& v = reg.GetComponent<Velocity>(ents[i]);
+            assert(p.x == x && p.y == (float)(i + 2));
+            assert(v.dx == 1 && v.dy == (even ? x : 0.0f) && v.dz == 1);
+            assert(reg.GetComponent<Collider>(ents[i]).radius == radius);
+            assert(states.Ref(ents[i]).Load().state == (int)i + 1001);
+
+            if (i < 64)
+            {
+                assert(reg.GetComponent<Slot>(ents[i]).id == (int)i + (even ? 0 : 100));
+            }
+        }
+
+        // Gather and scatter round trip on each storage kind, const components are never written back
+        const Entity block[] = { ents[3], ents[10], ents[2999] };
+        IComponentStorage* positions = (IComponentStorage*)&reg.GetStorage<Position, SparseComponentStorage<Position>>();
+        IComponentStorage* soa = (IComponentStorage*)&states;
+
+        Position gatheredPositions[3];
+        AIState gatheredStates[3];
+        GatherComponents(positions, block, 3, gatheredPositions);
+        GatherComponents(soa, block, 3, gatheredStates);
+        for (size_t i = 0; i < 3; ++i)
+        {
+            assert(gatheredPositions[i].x == reg.GetComponent<Position>(block[i]).x);
+            assert(gatheredStates[i].state == states.Ref(block[i]).Load().state);
+
+            gatheredPositions[i].z = 5;
+            gatheredStates[i].state = -1;
+        }
+
+        ScatterComponents<const Position>(positions, block, 3, gatheredPositions);
+        ScatterComponents<const AIState>(soa, block, 3, gatheredStates);
+        assert(reg.GetComponent<Position>(block[0]).z == 0 && states.Ref(block[0]).Load().state != -1);
+
+        ScatterComponents<Position>(positions, block, 3, gatheredPositions);
+        ScatterComponents<AIState>(soa, block, 3, gatheredStates);
+        for (Entity e : block)
+        {
+            assert(reg.GetComponent<Position>(e).z == 5 && states.Ref(e).Load().state == -1);
+        }
+
+        std::cout << "Typed storage tests passed\n";
+    }
+
+    void test_view_query_copies()
+    {
+        Registry reg;
+        for (int i = 0; i < 100; ++i)
+        {
+            reg.AddComponent<Position>(reg.CreateEntity());
+        }
+
+        int calls = 0;
+        ViewQuery<Position> query = reg.Filter<Position>();
+
+        // Assigned copies and moves call their own callable, not the one of a query that is gone
+        {
+            ViewQuery<Position> source = reg.Filter<Position>().ForEach(std::function<void(Position&)>([&](Position& p) { p.x += 1; calls++; }));
+            query = source;
+        }
+        query.Run();
+        assert(calls == 100);
+
+        ViewQuery<Position> moved = reg.Filter<Position>();
+        {
+            ViewQuery<Position> source = query;
+            moved = std::move(source);
+        }
+        moved.Run();
+        assert(calls == 200);
+
+        ViewQuery<Position> constructed = std::move(moved);
+        constructed.Run();
+        assert(calls == 300);
+
+        reg.Filter<Position>().ForEach([](Position& p) { assert(p.x == 3); }).Run();
+
+        std::cout << "ViewQuery copy tests passed\n";
+    }
+
+    // Entry point for the behavior tests above, each test asserts on failure and prints a line when it passes.
+    void run_tests()
+    {
+        test_archetype_storage();
+        test_owning_groups();
+        test_paged_storage();
+        test_soa_storage();
+        test_tag_storage();
+        test_persistent_queries();
+        test_sort_respect();
+        test_scheduled_queries();
+        test_command_buffers();
+        test_bulk_create_add();
+        test_bulk_remove_destroy();
+        test_job_system();
+        test_entity_handles();
+        test_component_masks();
+        test_entity_capacity();
+        test_query_planner();
+        test_typed_storages();
+        test_view_query_copies();
+    }
+
     //// Holds one invocation record
     //struct Record
     //{
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "IComponentStorage.h"
+#include "SparseComponentStorage.h"
+#include "SoAComponentStorage.h"
+#include "TagComponentStorage.h"
+
+namespace HBL2
+{
+    // Default number of entities per block handed out by the ForEachChunk queries.
+    static constexpr size_t QUERY_CHUNK_SIZE = 256;
+
+    // Storage of T cast to its concrete, final type. Has/Get are called directly and inline into the loop.
+    template<typename T, typename TStorage>
+    class DirectStorageRef
+    {
+    public:
+        explicit DirectStorageRef(IComponentStorage* storage)
+            : m_Storage((TStorage*)storage)
+        {
+        }
+
+        bool Has(Entity e) const { return m_Storage->Has(e); }
+        T& Get(Entity e) const { return *(T*)m_Storage->Get(e); }
+
+    private:
+        TStorage* m_Storage;
+    };
+
+    // Tags never touch their storage for Get, every entity shares the storage's value.
+    template<typename T>
+    class TagStorageRef
+    {
+    public:
+        explicit TagStorageRef(IComponentStorage* storage)
+            : m_Storage((TagComponentStorage<T>*)storage)
+        {
+        }
+
+        bool Has(Entity e) const { return m_Storage->Has(e); }
+        T& Get(Entity) const { return m_Storage->Value(); }
+
+    private:
+        TagComponentStorage<T>* m_Storage;
+    };
+
+    // Storage kinds without a typed fast path go through the vtable.
+    template<typename T>
+    class VirtualStorageRef
+    {
+    public:
+        explicit VirtualStorageRef(IComponentStorage* storage)
+            : m_Storage(storage)
+        {
+            HBL2_CORE_ASSERT(storage->Kind() != StorageKind::SoA, "SoA components have no addressable T, use ForEachChunk or the storage's Ref/Column!");
+        }
+
+        bool Has(Entity e) const { return m_Storage->Has(e); }
+        T& Get(Entity e) const { return *(T*)m_Storage->Get(e); }
+
+    private:
+        IComponentStorage* m_Storage;
+    };
+
+    // Calls func with the storage of T resolved from its kind. The kind is looked up once here and
+    // func is instantiated per kind, so the loop inside it makes no per entity dispatch.
+    template<typename T, typename Func>
+    void WithTypedStorage(IComponentStorage* storage, Func&& func)
+    {
+        if constexpr (IsTagComponent<T>)
+        {
+            func(TagStorageRef<T>(storage));
+        }
+        else
+        {
+            switch (storage->Kind())
+            {
+            case StorageKind::Sparse:
+                func(DirectStorageRef<T, SparseComponentStorage<T>>(storage));
+                break;
+            case StorageKind::SparsePaged:
+                func(DirectStorageRef<T, PagedComponentStorage<T>>(storage));
+                break;
+            default:
+                func(VirtualStorageRef<T>(storage));
+                break;
+            }
+        }
+    }
+
+    template<typename... Ts>
+    struct TypedStorageResolver;
+
+    template<>
+    struct TypedStorageResolver<>
+    {
+        template<typename Func, typename... Refs>
+        static void Resolve(IComponentStorage* const*, Func& func, const Refs&... refs)
+        {
+            func(refs...);
+        }
+    };
+
+    template<typename T, typename... Ts>
+    struct TypedStorageResolver<T, Ts...>
+    {
+        template<typename Func, typename... Refs>
+        static void Resolve(IComponentStorage* const* storages, Func& func, const Refs&... refs)
+        {
+            WithTypedStorage<T>(storages[0], [&](const auto& ref)
+            {
+                TypedStorageResolver<Ts...>::Resolve(storages + 1, func, refs..., ref);
+            });
+        }
+    };
+
+    // Resolves storages[i] as the storage of the i-th of Ts and calls func(refs...) with one typed
+    // reference per storage. The loop in func is instantiated once per combination of storage kinds,
+    // sparse, paged or other for each non tag component.
+    template<typename... Ts, typename Func>
+    void WithTypedStorages(IComponentStorage* const* storages, Func&& func)
+    {
+        TypedStorageResolver<Ts...>::Resolve(storages, func);
+    }
+
+    // Storage of T for code that can not be instantiated per kind, like the range-for iterators.
+    // The default sparse storage is picked once and called directly, other kinds use the vtable.
+    template<typename T>
+    class StorageRef
+    {
+    public:
+        StorageRef() = default;
+
+        explicit StorageRef(IComponentStorage* storage)
+            : m_Storage(storage)
+        {
+            if constexpr (!IsTagComponent<T>)
+            {
+                HBL2_CORE_ASSERT(storage->Kind() != StorageKind::SoA, "SoA components have no addressable T, use ForEachChunk or the storage's Ref/Column!");
+
+                if (storage->Kind() == StorageKind::Sparse)
+                {
+                    m_Sparse = (SparseComponentStorage<T>*)storage;
+                }
+            }
+        }
+
+        T& Get(Entity e) const
+        {
+            if constexpr (IsTagComponent<T>)
+            {
+                return ((TagComponentStorage<T>*)m_Storage)->Value();
+            }
+            else
+            {
+                return *(T*)(m_Sparse ? m_Sparse->Get(e) : m_Storage->Get(e));
+            }
+        }
+
+    private:
+        IComponentStorage* m_Storage = nullptr;
+        SparseComponentStorage<T>* m_Sparse = nullptr;
+    };
+
+    // True if every storage hands out addressable components, i.e. none of them is a SoA storage.
+    template<size_t Count>
+    bool AllAddressable(IComponentStorage* const* storages)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (storages[i]->Kind() == StorageKind::SoA)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Copies the T of entities[0, count) into out, the storage kind is resolved once for the whole block.
+    template<typename T>
+    void GatherComponents(IComponentStorage* storage, const Entity* entities, size_t count, T* out)
+    {
+        if constexpr (std::is_trivially_copyable_v<T> && !IsTagComponent<T>)
+        {
+            if (storage->Kind() == StorageKind::SoA)
+            {
+                auto* soa = (SoAComponentStorage<T>*)storage;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    out[i] = soa->Ref(entities[i]).Load();
+                }
+                return;
+            }
+        }
+
+        WithTypedStorage<T>(storage, [&](const auto& typed)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out[i] = typed.Get(entities[i]);
+            }
+        });
+    }
+
+    // Writes in[0, count) back as the C of entities[0, count). Const components and tags have nothing to write back.
+    template<typename C>
+    void ScatterComponents(IComponentStorage* storage, const Entity* entities, size_t count, const std::remove_const_t<C>* in)
+    {
+        using T = std::remove_const_t<C>;
+
+        if constexpr (!std::is_const_v<C> && !IsTagComponent<T>)
+        {
+            if constexpr (std::is_trivially_copyable_v<T>)
+            {
+                if (storage->Kind() == StorageKind::SoA)
+                {
+                    auto* soa = (SoAComponentStorage<T>*)storage;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        soa->Ref(entities[i]).Store(in[i]);
+                    }
+                    return;
+                }
+            }
+
+            WithTypedStorage<T>(storage, [&](const auto& typed)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    typed.Get(entities[i]) = in[i];
+                }
+            });
+        }
+    }
+
+    template<size_t ChunkSize, typename... Components, typename Entities, typename Func, size_t... Indices>
+    size_t RunGatheredImpl(IComponentStorage* const* storages, const Entities& entities, Func& func, std::index_sequence<Indices...>)
+    {
+        std::tuple<std::vector<std::remove_const_t<Components>>...> scratch = { std::vector<std::remove_const_t<Components>>(ChunkSize)... };
+        std::array<Entity, ChunkSize> block;
+        size_t n = 0;
+        size_t matches = 0;
+
+        auto flush = [&]()
+        {
+            (GatherComponents(storages[Indices], block.data(), n, std::get<Indices>(scratch).data()), ...);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                func((Components&)std::get<Indices>(scratch)[i]...);
+            }
+
+            (ScatterComponents<Components>(storages[Indices], block.data(), n, std::get<Indices>(scratch).data()), ...);
+
+            matches += n;
+            n = 0;
+        };
+
+        for (Entity e : entities)
+        {
+            block[n] = e;
+
+            if (++n == ChunkSize)
+            {
+                flush();
+            }
+        }
+
+        if (n)
+        {
+            flush();
+        }
+
+        return matches;
+    }
+
+    // Per entity query run for storages without addressable components (SoA). The components are
+    // gathered column by column into blocks of ChunkSize, func is called per entity on the copies and
+    // the mutable columns are written back after each block. Returns the number of matched entities.
+    template<size_t ChunkSize, typename... Components, typename Entities, typename Func>
+    size_t RunGathered(IComponentStorage* const* storages, const Entities& entities, Func& func)
+    {
+        return RunGatheredImpl<ChunkSize, Components...>(storages, entities, func, std::index_sequence_for<Components...>{});
+    }
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "IComponentStorage.h"
+#include "ArchetypeStorage.h"
+#include "TypedStorage.h"
+#include "BoundQuery.h"
+#include "Scheduler.h"
 
 namespace HBL2
 {
@@ -8,35 +12,232 @@ namespace HBL2
     class ViewQuery
     {
     public:
-        ViewQuery(IComponentStorage* storage)
-            : m_Storage(storage)
+        ViewQuery(IComponentStorage* storage, Scheduler* scheduler)
+            : m_Storage(storage), m_Scheduler(scheduler)
         {
 
         }
 
+        // The raw callback points at m_Callable, rebind it to the copy's own callable.
+        ViewQuery(const ViewQuery& other)
+            : m_Storage(other.m_Storage), m_Scheduler(other.m_Scheduler), m_Callable(other.m_Callable)
+        {
+            m_Function = MakeRawCallback<Component>(&m_Callable);
+        }
+
+        ViewQuery(ViewQuery&& other) noexcept
+            : m_Storage(other.m_Storage), m_Scheduler(other.m_Scheduler), m_Callable(std::move(other.m_Callable))
+        {
+            m_Function = MakeRawCallback<Component>(&m_Callable);
+        }
+
+        ViewQuery& operator=(const ViewQuery& other)
+        {
+            m_Storage = other.m_Storage;
+            m_Scheduler = other.m_Scheduler;
+            m_Callable = other.m_Callable;
+            m_Function = MakeRawCallback<Component>(&m_Callable);
+            return *this;
+        }
+
+        ViewQuery& operator=(ViewQuery&& other) noexcept
+        {
+            m_Storage = other.m_Storage;
+            m_Scheduler = other.m_Scheduler;
+            m_Callable = std::move(other.m_Callable);
+            m_Function = MakeRawCallback<Component>(&m_Callable);
+            return *this;
+        }
+
         ViewQuery& ForEach(std::function<void(Component&)>&& func)
         {
-            m_Function = MakeRawCallback<Component>(&func);
+            m_Callable = std::move(func);
+            m_Function = MakeRawCallback<Component>(&m_Callable);
             return *this;
         }
 
+        // Binds any invocable by type, see BoundQuery.
+        template<typename Func> requires (!std::is_same_v<std::decay_t<Func>, std::function<void(Component&)>> && std::is_invocable_v<Func&, Component&>)
+        BoundQuery<ViewQuery, std::decay_t<Func>> ForEach(Func&& func)
+        {
+            return BoundQuery<ViewQuery, std::decay_t<Func>>(std::move(*this), std::forward<Func>(func));
+        }
+
         void Run()
         {
             m_Storage->IterateRaw(m_Function);
         }
 
+        // Calls func(Span<Component>) with blocks of up to ChunkSize components. Sparse and archetype
+        // storages hand out slices of their packed arrays, other storages are gathered into a scratch
+        // block that is written back after the call unless Component is const.
+        template<size_t ChunkSize = QUERY_CHUNK_SIZE, typename Func>
+        void ForEachChunk(Func&& func)
+        {
+            using T = std::remove_const_t<Component>;
+
+            auto slice = [&](T* data, size_t count)
+            {
+                for (size_t first = 0; first < count; first += ChunkSize)
+                {
+                    func(Span<Component>(data + first, std::min(ChunkSize, count - first)));
+                }
+            };
+
+            if constexpr (!IsTagComponent<T>)
+            {
+                switch (m_Storage->Kind())
+                {
+                case StorageKind::Sparse:
+                    ((SparseComponentStorage<T>*)m_Storage)->ForEachBlock(slice);
+                    return;
+                case StorageKind::SparsePaged:
+                    ((PagedComponentStorage<T>*)m_Storage)->ForEachBlock(slice);
+                    return;
+                case StorageKind::Archetype:
+                    ((ArchetypeComponentStorage<T>*)m_Storage)->ForEachBlock(slice);
+                    return;
+                default:
+                    break;
+                }
+            }
+
+            std::vector<T> scratch(ChunkSize);
+            Span<const Entity> entities = m_Storage->Indices();
+
+            for (size_t first = 0; first < entities.Size(); first += ChunkSize)
+            {
+                size_t count = std::min(ChunkSize, entities.Size() - first);
+
+                GatherComponents(m_Storage, entities.Data() + first, count, scratch.data());
+                func(Span<Component>(scratch.data(), count));
+                ScatterComponents<Component>(m_Storage, entities.Data() + first, count, scratch.data());
+            }
+        }
+
+        // Records the query as a system run by Registry::ExecuteScheduledSystems, in parallel with other
+        // systems whose component access does not conflict. A const Component is only read.
         void Schedule()
         {
+            SystemEntry entry;
+            FillSystemAccess<Component>(entry);
+
+            entry.Task = [query = *this]() mutable
+            {
+                query.Run();
+            };
+
+            m_Scheduler->Register(std::move(entry));
+        }
+
+        // Queues the work on ctx without waiting for it, the query must stay alive until ctx is waited on.
+        // The packed array is split in ranges of grainSize components (0 picks one from the thread count),
+        // one job per range. Storages without a packed array of Component run inline instead.
+        void Schedule(JobContext& ctx, uint32_t grainSize = 0)
+        {
+            ScheduleWith(m_Callable, ctx, grainSize);
+        }
+
+        void Dispatch(uint32_t grainSize = 0)
+        {
+            DispatchWith(m_Callable, grainSize);
+        }
+
+    private:
+        template<typename, typename>
+        friend class BoundQuery;
+
+        // Typed counterpart of Run(), sparse and archetype storages are walked over their packed arrays.
+        template<typename Func>
+        void RunWith(Func& func)
+        {
+            ForEachChunk([&](Span<Component> block)
+            {
+                for (size_t i = 0; i < block.Size(); ++i)
+                {
+                    func(block[i]);
+                }
+            });
+        }
+
+        template<typename Func>
+        void ScheduleWith(const Func& func)
+        {
+            SystemEntry entry;
+            FillSystemAccess<Component>(entry);
+
+            entry.Task = [query = *this, func]() mutable
+            {
+                query.RunWith(func);
+            };
+
+            m_Scheduler->Register(std::move(entry));
+        }
+
+        template<typename Func>
+        void ScheduleWith(Func& func, JobContext& ctx, uint32_t grainSize = 0)
+        {
+            using T = std::remove_const_t<Component>;
+
+            if constexpr (IsTagComponent<T>)
+            {
+                // Every entity shares one value
+                RunWith(func);
+            }
+            else
+            {
+                uint32_t count = (uint32_t)m_Storage->Indices().Size();
+                uint32_t grain = grainSize ? grainSize : std::max(32u, count / (JobSystem::Get().GetThreadCount() * 4));
+
+                auto partition = [&](T* data, size_t size)
+                {
+                    for (size_t first = 0; first < size; first += grain)
+                    {
+                        Component* begin = data + first;
+                        size_t n = std::min<size_t>(grain, size - first);
+
+                        JobSystem::Get().Execute(ctx, [&func, begin, n]()
+                        {
+                            for (size_t i = 0; i < n; ++i)
+                            {
+                                func(begin[i]);
+                            }
+                        });
+                    }
+                };
 
+                switch (m_Storage->Kind())
+                {
+                case StorageKind::Sparse:
+                    ((SparseComponentStorage<T>*)m_Storage)->ForEachBlock(partition);
+                    break;
+                case StorageKind::SparsePaged:
+                    ((PagedComponentStorage<T>*)m_Storage)->ForEachBlock(partition);
+                    break;
+                case StorageKind::Archetype:
+                    ((ArchetypeComponentStorage<T>*)m_Storage)->ForEachBlock(partition);
+                    break;
+                default:
+                    RunWith(func);
+                    break;
+                }
+            }
         }
 
-        void Dispatch()
+        template<typename Func>
+        void DispatchWith(Func& func, uint32_t grainSize = 0)
         {
+            JobContext ctx;
+            ScheduleWith(func, ctx, grainSize);
 
+            // Wait for completion
+            JobSystem::Get().Wait(ctx);
         }
 
     private:
         IComponentStorage* m_Storage = nullptr;
+        Scheduler* m_Scheduler = nullptr;
+        std::function<void(Component&)> m_Callable;
         TrampolineFunction<void, void*> m_Function;
     };
 }
\ No newline at end of file
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+namespace HBL2
+{
+    // Counts the jobs submitted with it that did not finish yet, see JobSystem::Wait.
+    struct JobContext
+    {
+        std::atomic<uint32_t> counter{ 0 };
+    };
+
+    // Work stealing job system. Every worker owns a Chase-Lev deque: it pushes and pops its own
+    // jobs at the bottom (LIFO, cache warm) while idle workers steal from the top (FIFO, oldest and
+    // usually largest work first). Jobs submitted from threads that are not workers go through a
+    // shared injection queue. The thread calling Initialize becomes worker 0.
+    //
+    // Wait() runs jobs while it waits, so a job may submit and wait for more jobs without
+    // blocking a worker. Before Initialize (or after Shutdown) every job runs inline.
+    class JobSystem
+    {
+    public:
+        static JobSystem& Get()
+        {
+            static JobSystem s_Instance;
+            return s_Instance;
+        }
+
+        // threadCount includes the calling thread, 0 uses every hardware thread.
+        static void Initialize(uint32_t threadCount = 0)
+        {
+            Get().Start(threadCount);
+        }
+
+        static void Shutdown()
+        {
+            Get().Stop();
+        }
+
+        uint32_t GetThreadCount() const
+        {
+            return m_ThreadCount;
+        }
+
+        // Index of the calling worker in [0, GetThreadCount()), -1 on threads that are not workers.
+        int32_t GetWorkerIndex() const
+        {
+            return s_Owner == this ? s_WorkerIndex : -1;
+        }
+
+        void Execute(JobContext& ctx, std::function<void()> task)
+        {
+            ctx.counter.fetch_add(1, std::memory_order_relaxed);
+
+            Job* job = new Job{ std::move(task), &ctx };
+
+            if (m_ThreadCount <= 1)
+            {
+                Run(job);
+                return;
+            }
+
+            if (s_WorkerIndex >= 0 && s_Owner == this)
+            {
+                // Full deque, the job runs right away instead of growing the buffer
+                if (!m_Workers[s_WorkerIndex]->Queue.Push(job))
+                {
+                    Run(job);
+                    return;
+                }
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(m_InjectedMutex);
+                m_Injected.push_back(job);
+                m_InjectedCount.fetch_add(1, std::memory_order_release);
+            }
+
+            Wake();
+        }
+
+        // Splits [0, jobCount) into groups of groupSize and runs func(first, last) for each group.
+        // The jobs refer to func, it has to outlive Wait(ctx).
+        void Dispatch(JobContext& ctx, uint32_t jobCount, uint32_t groupSize, const std::function<void(uint32_t, uint32_t)>& func)
+        {
+            if (jobCount == 0 || groupSize == 0)
+            {
+                return;
+            }
+
+            for (uint32_t first = 0; first < jobCount; first += groupSize)
+            {
+                uint32_t last = std::min(jobCount, first + groupSize);
+                Execute(ctx, [&func, first, last]() { func(first, last); });
+            }
+        }
+
+        // Runs func over every entity of the mask, fetching Components from storages. The mask is
+        // cut into runs of occupied words holding about groupSize entities each, counted with popcount
+        // on the summary selected words, so every job gets the same amount of entities whatever the density.
+        // Mask is expected to have the ComponentMaskAVX layout (data, summary, words).
+        template<typename... Components, typename Mask, typename Storages, typename Func, size_t... Indices>
+        void DispatchQuery(JobContext& ctx, const Mask& mask, Storages& storages, uint32_t groupSize, Func& func, std::index_sequence<Indices...>)
+        {
+            auto runWords = [&mask, &storages, &func](size_t firstWord, size_t lastWord)
+            {
+                ForEachInWords(mask, firstWord, lastWord, [&](uint32_t e)
+                {
+                    func((Components&)*((Components*)(storages[Indices]->Get(e)))...);
+                });
+            };
+
+            size_t summaryWords = (mask.words + 63) >> 6;
+            size_t firstWord = SIZE_MAX;
+            size_t lastWord = 0;
+            size_t population = 0;
+
+            for (size_t si = 0; si < summaryWords; ++si)
+            {
+                uint64_t s = mask.summary[si];
+                while (s)
+                {
+                    size_t wi = si * 64 + CountTrailingZeros(s);
+                    s &= s - 1;
+
+                    if (firstWord == SIZE_MAX)
+                    {
+                        firstWord = wi;
+                    }
+
+                    lastWord = wi + 1;
+                    population += PopCount(mask.data[wi]);
+
+                    if (population >= groupSize)
+                    {
+                        Execute(ctx, [runWords, firstWord, lastWord]() { runWords(firstWord, lastWord); });
+                        firstWord = SIZE_MAX;
+                        population = 0;
+                    }
+                }
+            }
+
+            if (firstWord != SIZE_MAX)
+            {
+                Execute(ctx, [runWords, firstWord, lastWord]() { runWords(firstWord, lastWord); });
+            }
+        }
+
+        // Runs pending jobs until every job of ctx finished.
+        void Wait(JobContext& ctx)
+        {
+            uint32_t idle = 0;
+            while (ctx.counter.load(std::memory_order_acquire) > 0)
+            {
+                if (RunOne())
+                {
+                    idle = 0;
+                    continue;
+                }
+
+                if (++idle < 64)
+                {
+                    _mm_pause();
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        ~JobSystem()
+        {
+            Stop();
+        }
+
+    private:
+        struct Job
+        {
+            std::function<void()> Task;
+            JobContext* Context;
+        };
+
+        // Chase-Lev deque with a fixed ring buffer, after Le, Pop, Cohen and Zappa Nardelli,
+        // "Correct and Efficient Work-Stealing for Weak Memory Models" (2013).
+        class WorkStealingQueue
+        {
+        public:
+            static constexpr int64_t CAPACITY = 1 << 12;
+
+            // Owner only
+            bool Push(Job* job)
+            {
+                int64_t b = m_Bottom.load(std::memory_order_relaxed);
+                int64_t t = m_Top.load(std::memory_order_acquire);
+                if (b - t >= CAPACITY)
+                {
+                    return false;
+                }
+
+                // Publishes the job to thieves that acquire m_Bottom
+                m_Buffer[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+                m_Bottom.store(b + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Owner only
+            Job* Pop()
+            {
+                int64_t b = m_Bottom.load(std::memory_order_relaxed) - 1;
+                m_Bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int64_t t = m_Top.load(std::memory_order_relaxed);
+
+                if (t > b)
+                {
+                    m_Bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                Job* job = m_Buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+                if (t == b)
+                {
+                    // Last job, race the thieves for it
+                    if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        job = nullptr;
+                    }
+                    m_Bottom.store(b + 1, std::memory_order_relaxed);
+                }
+
+                return job;
+            }
+
+            // Any thread
+            Job* Steal()
+            {
+                int64_t t = m_Top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int64_t b = m_Bottom.load(std::memory_order_acquire);
+
+                if (t >= b)
+                {
+                    return nullptr;
+                }
+
+                Job* job = m_Buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+                if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    return nullptr;
+                }
+
+                return job;
+            }
+
+        private:
+            // Owner and thieves write different ends, keep them on different cache lines
+            alignas(64) std::atomic<int64_t> m_Top{ 0 };
+            alignas(64) std::atomic<int64_t> m_Bottom{ 0 };
+            alignas(64) std::atomic<Job*> m_Buffer[CAPACITY] = {};
+        };
+
+        struct alignas(64) Worker
+        {
+            WorkStealingQueue Queue;
+            std::thread Thread;
+            uint64_t Random = 0;
+        };
+
+        void Start(uint32_t threadCount)
+        {
+            Stop();
+
+            if (threadCount == 0)
+            {
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            m_Running.store(true, std::memory_order_release);
+
+            m_Workers.clear();
+            for (uint32_t i = 0; i < threadCount; ++i)
+            {
+                m_Workers.push_back(std::make_unique<Worker>());
+                m_Workers[i]->Random = 0x9E3779B97F4A7C15ULL * (i + 1);
+            }
+
+            // The calling thread is worker 0, it runs jobs while it waits
+            s_WorkerIndex = 0;
+            s_Owner = this;
+
+            for (uint32_t i = 1; i < threadCount; ++i)
+            {
+                m_Workers[i]->Thread = std::thread([this, i]() { WorkerLoop(i); });
+            }
+
+            m_ThreadCount = threadCount;
+        }
+
+        void Stop()
+        {
+            if (m_Workers.empty())
+            {
+                return;
+            }
+
+            // Drain what is left so no context waits forever
+            while (RunOne())
+            {
+            }
+
+            m_Running.store(false, std::memory_order_release);
+            m_Epoch.fetch_add(1, std::memory_order_release);
+            m_Epoch.notify_all();
+
+            for (std::unique_ptr<Worker>& worker : m_Workers)
+            {
+                if (worker->Thread.joinable())
+                {
+                    worker->Thread.join();
+                }
+            }
+
+            m_Workers.clear();
+            m_ThreadCount = 1;
+
+            if (s_Owner == this)
+            {
+                s_WorkerIndex = -1;
+                s_Owner = nullptr;
+            }
+        }
+
+        void WorkerLoop(uint32_t index)
+        {
+            s_WorkerIndex = (int32_t)index;
+            s_Owner = this;
+
+            while (m_Running.load(std::memory_order_acquire))
+            {
+                if (RunOne())
+                {
+                    continue;
+                }
+
+                // Spin briefly before sleeping, new work usually follows shortly within a frame
+                uint32_t epoch = m_Epoch.load(std::memory_order_acquire);
+
+                bool found = false;
+                for (uint32_t spin = 0; spin < 256 && !found; ++spin)
+                {
+                    _mm_pause();
+                    found = RunOne();
+                }
+
+                if (found)
+                {
+                    continue;
+                }
+
+                // Any Execute after the epoch was read changes it, so the wait cannot miss a wake up
+                m_Sleeping.fetch_add(1, std::memory_order_seq_cst);
+                if (!RunOne() && m_Running.load(std::memory_order_acquire))
+                {
+                    m_Epoch.wait(epoch, std::memory_order_acquire);
+                }
+                m_Sleeping.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            s_WorkerIndex = -1;
+            s_Owner = nullptr;
+        }
+
+        void Wake()
+        {
+            m_Epoch.fetch_add(1, std::memory_order_seq_cst);
+            if (m_Sleeping.load(std::memory_order_seq_cst) > 0)
+            {
+                m_Epoch.notify_one();
+            }
+        }
+
+        // Own deque first, then the injection queue, then steal from a random victim.
+        bool RunOne()
+        {
+            if (m_Workers.empty())
+            {
+                return false;
+            }
+
+            int32_t self = (s_Owner == this) ? s_WorkerIndex : -1;
+
+            if (self >= 0)
+            {
+                if (Job* job = m_Workers[self]->Queue.Pop())
+                {
+                    Run(job);
+                    return true;
+                }
+            }
+
+            if (m_InjectedCount.load(std::memory_order_acquire) > 0)
+            {
+                Job* job = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(m_InjectedMutex);
+                    if (!m_Injected.empty())
+                    {
+                        job = m_Injected.front();
+                        m_Injected.pop_front();
+                        m_InjectedCount.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+
+                if (job)
+                {
+                    Run(job);
+                    return true;
+                }
+            }
+
+            const uint32_t count = (uint32_t)m_Workers.size();
+            uint32_t start = (uint32_t)(NextRandom(self) % count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t victim = (start + i) % count;
+                if ((int32_t)victim == self)
+                {
+                    continue;
+                }
+
+                if (Job* job = m_Workers[victim]->Queue.Steal())
+                {
+                    Run(job);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        static void Run(Job* job)
+        {
+            JobContext* ctx = job->Context;
+            job->Task();
+            delete job;
+
+            ctx->counter.fetch_sub(1, std::memory_order_release);
+        }
+
+        uint64_t NextRandom(int32_t self)
+        {
+            // xorshift, per worker so thieves do not all start at the same victim
+            static thread_local uint64_t s_External = 0x2545F4914F6CDD1DULL ^ (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+            uint64_t& x = self >= 0 ? m_Workers[self]->Random : s_External;
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            return x;
+        }
+
+        template<typename Mask, typename Func>
+        static void ForEachInWords(const Mask& mask, size_t firstWord, size_t lastWord, Func&& func)
+        {
+            for (size_t si = firstWord >> 6, end = ((lastWord - 1) >> 6); si <= end; ++si)
+            {
+                uint64_t s = mask.summary[si];
+                if (si == (firstWord >> 6))
+                {
+                    s &= ~0ULL << (firstWord & 63);
+                }
+                if (si == end)
+                {
+                    s &= ~0ULL >> (63 - ((lastWord - 1) & 63));
+                }
+
+                while (s)
+                {
+                    size_t wi = si * 64 + CountTrailingZeros(s);
+                    s &= s - 1;
+
+                    uint64_t bits = mask.data[wi];
+                    while (bits)
+                    {
+                        func((uint32_t)(wi * 64 + CountTrailingZeros(bits)));
+                        bits &= bits - 1;
+                    }
+                }
+            }
+        }
+
+        static uint32_t CountTrailingZeros(uint64_t x)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward64(&index, x);
+            return (uint32_t)index;
+#else
+            return (uint32_t)__builtin_ctzll(x);
+#endif
+        }
+
+        static uint32_t PopCount(uint64_t x)
+        {
+            return (uint32_t)_mm_popcnt_u64(x);
+        }
+
+    private:
+        std::vector<std::unique_ptr<Worker>> m_Workers;
+        uint32_t m_ThreadCount = 1;
+        std::atomic<bool> m_Running{ false };
+
+        std::mutex m_InjectedMutex;
+        std::deque<Job*> m_Injected;
+        std::atomic<uint32_t> m_InjectedCount{ 0 };
+
+        // Bumped by every Execute, idle workers sleep on it
+        std::atomic<uint32_t> m_Epoch{ 0 };
+        std::atomic<uint32_t> m_Sleeping{ 0 };
+
+        static inline thread_local int32_t s_WorkerIndex = -1;
+        static inline thread_local JobSystem* s_Owner = nullptr;
+    };
+}